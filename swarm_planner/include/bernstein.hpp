@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+namespace SwarmPlanning {
+    const int BERNSTEIN_MAX_N = 7; // the largest supported degree, the same as the crazyswarm csv
+
+    // Compile-time tables of the Bernstein polynomials of degree n on [0, 1].
+    // The power basis is in descending order, column c is the coefficient of t^(n - c).
+    namespace bernstein {
+        template<int R, int C>
+        struct Table {
+            double v[R][C];
+        };
+
+        constexpr double binomial(int n, int k) {
+            double b = 1;
+            for (int i = 1; i <= k; i++) {
+                b = b * (n - k + i) / i;
+            }
+            return b;
+        }
+
+        // n! / (n - k)!
+        constexpr double falling(int n, int k) {
+            double f = 1;
+            for (int i = 0; i < k; i++) {
+                f *= n - i;
+            }
+            return f;
+        }
+
+        // Row i is the i-th Bernstein polynomial C(n, i) t^i (1 - t)^(n - i) in the power basis
+        template<int n>
+        constexpr Table<n + 1, n + 1> basisTable() {
+            Table<n + 1, n + 1> table{};
+            for (int i = 0; i <= n; i++) {
+                for (int p = i; p <= n; p++) {
+                    table.v[i][n - p] = binomial(n, i) * binomial(n - i, p - i) * ((p - i) % 2 == 0 ? 1 : -1);
+                }
+            }
+            return table;
+        }
+
+        // Integral of the squared phi-th derivative over [0, 1] as a quadratic form of the control points
+        template<int n, int phi>
+        constexpr Table<n + 1, n + 1> costTable() {
+            Table<n + 1, n + 1> basis = basisTable<n>();
+            Table<n + 1, n + 1> table{};
+            for (int i = 0; i <= n; i++) {
+                for (int j = 0; j <= n; j++) {
+                    for (int p = phi; p <= n; p++) {
+                        for (int q = phi; q <= n; q++) {
+                            table.v[i][j] += basis.v[i][n - p] * basis.v[j][n - q] * falling(p, phi) *
+                                             falling(q, phi) / (p + q - 2 * phi + 1);
+                        }
+                    }
+                }
+            }
+            return table;
+        }
+
+        // Row i is the i-th forward difference of the control points at the start,
+        // the i-th derivative at t = 0 is n! / (n - i)! times it
+        template<int n>
+        constexpr Table<n + 1, n + 1> startTable() {
+            Table<n + 1, n + 1> table{};
+            for (int i = 0; i <= n; i++) {
+                for (int j = 0; j <= i; j++) {
+                    table.v[i][j] = binomial(i, j) * ((i - j) % 2 == 0 ? 1 : -1);
+                }
+            }
+            return table;
+        }
+
+        // Row i is the i-th forward difference of the control points at the end
+        template<int n>
+        constexpr Table<n + 1, n + 1> endTable() {
+            Table<n + 1, n + 1> table{};
+            for (int i = 0; i <= n; i++) {
+                for (int j = 0; j <= i; j++) {
+                    table.v[i][n - i + j] = binomial(i, j) * ((i - j) % 2 == 0 ? 1 : -1);
+                }
+            }
+            return table;
+        }
+
+        template<int R, int C>
+        Eigen::MatrixXd toMatrix(const Table<R, C> &table) {
+            Eigen::MatrixXd matrix(R, C);
+            for (int i = 0; i < R; i++) {
+                for (int j = 0; j < C; j++) {
+                    matrix(i, j) = table.v[i][j];
+                }
+            }
+            return matrix;
+        }
+
+        // Upper bound of |p(t)| on [0, 1] for the Bernstein polynomial p with degree + 1 control points.
+        // The curve lies in the convex hull of its control points, so max |ctrl| is an upper bound and
+        // the end points are attained. The pieces whose hull exceeds the best attained value are split at
+        // the middle by de Casteljau until the bound is within the relative tolerance tol, and the largest
+        // hull of the remaining pieces is returned, which is at most best * (1 + tol) + abs_tol.
+        // Returns lower_bound if the maximum does not exceed it.
+        inline double maxAbs(const double *ctrl, int degree, double lower_bound, double tol) {
+            typedef std::array<double, BERNSTEIN_MAX_N + 1> Piece;
+            const int max_depth = 30;
+            const double abs_tol = 1e-9;
+
+            double best = std::max({lower_bound, std::abs(ctrl[0]), std::abs(ctrl[degree])});
+            double bound = lower_bound;
+            std::vector<std::pair<Piece, int>> pieces(1);
+            std::copy(ctrl, ctrl + degree + 1, pieces[0].first.begin());
+            pieces[0].second = 0;
+            while (!pieces.empty()) {
+                Piece b = pieces.back().first;
+                int depth = pieces.back().second;
+                pieces.pop_back();
+
+                double upper = 0;
+                for (int i = 0; i <= degree; i++) {
+                    upper = std::max(upper, std::abs(b[i]));
+                }
+                if (upper <= best * (1 + tol) + abs_tol || depth >= max_depth) {
+                    bound = std::max(bound, upper);
+                    continue;
+                }
+
+                // de Casteljau at t = 0.5, left takes the first control point of each level
+                Piece left, right;
+                for (int r = 0; r <= degree; r++) {
+                    left[r] = b[0];
+                    right[degree - r] = b[degree - r];
+                    for (int i = 0; i < degree - r; i++) {
+                        b[i] = 0.5 * (b[i] + b[i + 1]);
+                    }
+                }
+                best = std::max(best, std::abs(left[degree]));
+                pieces.emplace_back(left, depth + 1);
+                pieces.emplace_back(right, depth + 1);
+            }
+            return bound;
+        }
+    }
+
+    // Bernstein polynomials of degree n with the minimum phi-th derivative cost
+    class BernsteinBasis {
+    public:
+        virtual ~BernsteinBasis() = default;
+
+        int getDegree() const {
+            return n;
+        }
+
+        int getPhi() const {
+            return phi;
+        }
+
+        // Bernstein to power basis, (n + 1) x (n + 1)
+        const Eigen::MatrixXd &getBasis() const {
+            return basis;
+        }
+
+        // Cost of a segment of unit duration, the cost of duration dt is cost * dt^(1 - 2 phi)
+        const Eigen::MatrixXd &getCost() const {
+            return cost;
+        }
+
+        // Derivative maps at the start and end of a segment of unit duration, see bernstein::startTable
+        const Eigen::MatrixXd &getStartDerivatives() const {
+            return start_derivatives;
+        }
+
+        const Eigen::MatrixXd &getEndDerivatives() const {
+            return end_derivatives;
+        }
+
+        // Polynomial coefficients of a segment of duration dt in descending order from its n + 1 control points
+        virtual void toPolynomial(const double *ctrl, double dt, double *coef) const = 0;
+
+    protected:
+        int n, phi;
+        Eigen::MatrixXd basis, cost, start_derivatives, end_derivatives;
+    };
+
+    template<int N, int PHI>
+    class FixedBernsteinBasis : public BernsteinBasis {
+    public:
+        typedef Eigen::Matrix<double, N + 1, 1> Vector;
+
+        FixedBernsteinBasis() {
+            n = N;
+            phi = PHI;
+            basis = bernstein::toMatrix(bernstein::basisTable<N>());
+            cost = bernstein::toMatrix(bernstein::costTable<N, PHI>());
+            start_derivatives = bernstein::toMatrix(bernstein::startTable<N>());
+            end_derivatives = bernstein::toMatrix(bernstein::endTable<N>());
+        }
+
+        void toPolynomial(const double *ctrl, double dt, double *coef) const override {
+            constexpr bernstein::Table<N + 1, N + 1> table = bernstein::basisTable<N>();
+            Eigen::Map<const Vector> c(ctrl);
+            Eigen::Map<Vector> a(coef);
+            double scale = 1;
+            for (int col = N; col >= 0; col--) {
+                double sum = 0;
+                for (int i = 0; i <= N; i++) {
+                    sum += table.v[i][col] * c(i);
+                }
+                a(col) = sum * scale;
+                scale /= dt;
+            }
+        }
+    };
+
+    namespace bernstein {
+        // Instantiations for 2 phi - 1 <= n <= BERNSTEIN_MAX_N, the smallest degree that satisfies
+        // the start and goal conditions up to the (phi - 1)-th derivative in a single segment
+        template<int n, int phi, bool valid = (n >= 2 * phi - 1)>
+        struct Factory {
+            static std::shared_ptr<BernsteinBasis> create(int _n) {
+                if (_n == n) {
+                    return std::make_shared<FixedBernsteinBasis<n, phi>>();
+                }
+                return Factory<n - 1, phi>::create(_n);
+            }
+        };
+
+        template<int n, int phi>
+        struct Factory<n, phi, false> {
+            static std::shared_ptr<BernsteinBasis> create(int) {
+                return nullptr;
+            }
+        };
+    }
+
+    // nullptr if (n, phi) is not supported
+    inline std::shared_ptr<BernsteinBasis> createBernsteinBasis(int n, int phi) {
+        switch (phi) {
+            case 1:
+                return bernstein::Factory<BERNSTEIN_MAX_N, 1>::create(n);
+            case 2:
+                return bernstein::Factory<BERNSTEIN_MAX_N, 2>::create(n);
+            case 3:
+                return bernstein::Factory<BERNSTEIN_MAX_N, 3>::create(n);
+            case 4:
+                return bernstein::Factory<BERNSTEIN_MAX_N, 4>::create(n);
+            default:
+                return nullptr;
+        }
+    }
+}
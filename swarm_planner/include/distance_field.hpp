@@ -0,0 +1,934 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <ros/ros.h>
+#include <octomap/OcTree.h>
+#include <dynamicEDT3D/dynamicEDTOctomap.h>
+
+#include <parallel.hpp>
+#include <param.hpp>
+
+namespace SwarmPlanning {
+    // Euclidean distance field of obstacles, saturated at getMaxDist()
+    class DistanceField {
+    public:
+        virtual ~DistanceField() = default;
+
+        // Distance to the closest obstacle, negative if p is out of the map
+        virtual float getDistance(const octomap::point3d &p) const = 0;
+
+        virtual void getDistanceAndClosestObstacle(const octomap::point3d &p, float &distance,
+                                                   octomap::point3d &closestObstacle) const = 0;
+
+        virtual float getMaxDist() const = 0;
+
+        // Distances at the points of the lattice xs x ys x zs, dist[(k * ys.size() + j) * xs.size() + i]
+        virtual void getDistances(const std::vector<double> &xs, const std::vector<double> &ys,
+                                  const std::vector<double> &zs, std::vector<float> *dist) const {
+            dist->resize(xs.size() * ys.size() * zs.size());
+            int idx = 0;
+            for (double z : zs) {
+                for (double y : ys) {
+                    for (double x : xs) {
+                        (*dist)[idx++] = getDistance(octomap::point3d(x, y, z));
+                    }
+                }
+            }
+        }
+
+        // Whether the distance at any point of the lattice xs x ys x zs is less than threshold
+        virtual bool isAnyBelow(const std::vector<double> &xs, const std::vector<double> &ys,
+                                const std::vector<double> &zs, float threshold) const {
+            for (double z : zs) {
+                for (double y : ys) {
+                    for (double x : xs) {
+                        if (getDistance(octomap::point3d(x, y, z)) < threshold) {
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+    protected:
+        // Closest obstacle if there is none within maxDist or p is out of the map, the same as DynamicEDTOctomap
+        static octomap::point3d noClosestObstacle() {
+            return octomap::point3d(DynamicEDTOctomap::distanceValue_Error, DynamicEDTOctomap::distanceValue_Error,
+                                    DynamicEDTOctomap::distanceValue_Error);
+        }
+    };
+
+    // DynamicEDTOctomap built from the octree, the octree must outlive the field
+    class EDTDistanceField : public DistanceField {
+    public:
+        EDTDistanceField(float _maxDist, octomap::OcTree *_octree,
+                         const octomap::point3d &_min_point3d, const octomap::point3d &_max_point3d)
+                : edt(_maxDist, _octree, _min_point3d, _max_point3d, false),
+                  maxDist(_maxDist),
+                  octree(_octree),
+                  min_point3d(_min_point3d),
+                  max_point3d(_max_point3d) {
+            edt.update();
+        }
+
+        // Apply the difference of new_octree in the world bounds to the octree, and update the distance
+        // of the changed cells incrementally. Unknown cells are free.
+        // changed_box is the bounding box of the changed cells, empty if nothing is changed.
+        void updateMap(const octomap::OcTree &new_octree, std::vector<double> *changed_box) {
+            changed_box->clear();
+            // Change detection is needed only by the continuous map, so it is enabled on the first update
+            octree->enableChangeDetection(true);
+            octree->resetChangeDetection();
+
+            // Occupied in new_octree
+            for (auto it = new_octree.begin_leafs_bbx(min_point3d, max_point3d), end = new_octree.end_leafs_bbx();
+                 it != end; ++it) {
+                if (new_octree.isNodeOccupied(*it)) {
+                    updateLeaf(it.getCoordinate(), it.getSize(), true, changed_box);
+                }
+            }
+            // Occupied in octree, but free or unknown in new_octree
+            std::vector<std::pair<octomap::point3d, double>> removed;
+            for (auto it = octree->begin_leafs_bbx(min_point3d, max_point3d), end = octree->end_leafs_bbx();
+                 it != end; ++it) {
+                if (octree->isNodeOccupied(*it)) {
+                    removed.emplace_back(std::make_pair(it.getCoordinate(), it.getSize()));
+                }
+            }
+            for (const auto &leaf : removed) {
+                updateLeaf(leaf.first, leaf.second, false, changed_box, &new_octree);
+            }
+
+            if (octree->numChangesDetected() > 0) {
+                edt.update();
+            }
+        }
+
+        float getDistance(const octomap::point3d &p) const override {
+            return edt.getDistance(p);
+        }
+
+        void getDistanceAndClosestObstacle(const octomap::point3d &p, float &distance,
+                                           octomap::point3d &closestObstacle) const override {
+            edt.getDistanceAndClosestObstacle(p, distance, closestObstacle);
+        }
+
+        float getMaxDist() const override {
+            return maxDist;
+        }
+
+    private:
+        DynamicEDTOctomap edt;
+        float maxDist;
+        octomap::OcTree *octree;
+        octomap::point3d min_point3d, max_point3d;
+
+        // Set the cells of the leaf to occupied (free). If new_octree is given, only the cells which are not
+        // occupied in new_octree are set.
+        void updateLeaf(const octomap::point3d &center, double size, bool occupied, std::vector<double> *changed_box,
+                        const octomap::OcTree *new_octree = nullptr) {
+            double res = octree->getResolution();
+            int n = std::max<int>((int) round(size / res), 1);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    for (int k = 0; k < n; k++) {
+                        octomap::point3d cell(center.x() + (i + 0.5 - n / 2.0) * res,
+                                              center.y() + (j + 0.5 - n / 2.0) * res,
+                                              center.z() + (k + 0.5 - n / 2.0) * res);
+                        octomap::OcTreeKey key = octree->coordToKey(cell);
+                        if (new_octree != nullptr) {
+                            octomap::OcTreeNode *new_node = new_octree->search(key);
+                            if (new_node != nullptr && new_octree->isNodeOccupied(new_node)) {
+                                continue;
+                            }
+                        }
+                        octomap::OcTreeNode *node = octree->search(key);
+                        bool was_occupied = node != nullptr && octree->isNodeOccupied(node);
+                        if (was_occupied == occupied) {
+                            continue;
+                        }
+                        octree->setNodeValue(key, occupied ? octree->getClampingThresMaxLog()
+                                                           : octree->getClampingThresMinLog());
+
+                        if (changed_box->empty()) {
+                            *changed_box = {SP_INFINITY, SP_INFINITY, SP_INFINITY,
+                                            -SP_INFINITY, -SP_INFINITY, -SP_INFINITY};
+                        }
+                        for (int l = 0; l < 3; l++) {
+                            (*changed_box)[l] = std::min((*changed_box)[l], cell(l) - res / 2);
+                            (*changed_box)[l + 3] = std::max((*changed_box)[l + 3], cell(l) + res / 2);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // Intersection of the parabolas rooted at p and q
+    inline float intersectParabola(const float *g, int p, int q) {
+        return ((g[q] + q * q) - (g[p] + p * p)) / (2.0f * (q - p));
+    }
+
+    // 1D squared distance transform of f (lower envelope of parabolas) with the closest site, in place.
+    // buffer holds the values of f (n) and the envelope boundaries (n + 1).
+    inline void transformLine(float *f, int32_t *obs, int stride, int n,
+                              float *buffer, int *vertex, int *site) {
+        float *g = buffer;
+        float *z = buffer + n;
+        for (int q = 0; q < n; q++) {
+            g[q] = f[q * stride];
+            site[q] = obs[q * stride];
+        }
+
+        int k = -1;
+        for (int q = 0; q < n; q++) {
+            if (g[q] >= SP_INFINITY) {
+                continue;
+            }
+            if (k < 0) {
+                k = 0;
+                vertex[0] = q;
+                z[0] = -SP_INFINITY;
+                z[1] = SP_INFINITY;
+                continue;
+            }
+            float s = intersectParabola(g, vertex[k], q);
+            while (s <= z[k]) {
+                k--;
+                s = intersectParabola(g, vertex[k], q);
+            }
+            k++;
+            vertex[k] = q;
+            z[k] = s;
+            z[k + 1] = SP_INFINITY;
+        }
+        if (k < 0) {
+            return;
+        }
+
+        k = 0;
+        for (int q = 0; q < n; q++) {
+            while (z[k + 1] < q) {
+                k++;
+            }
+            int p = vertex[k];
+            f[q * stride] = (q - p) * (q - p) + g[p];
+            obs[q * stride] = site[p];
+        }
+    }
+
+    // Dense distance grid on the octree cells, which is saved to a binary file and memory-mapped when loaded.
+    // File layout: Header, float distance[size], int32 closest obstacle cell[size] (-1 if farther than maxDist)
+    class GridDistanceField : public DistanceField {
+    public:
+        struct Header {
+            char magic[8];
+            uint64_t hash;
+            int32_t key_min[3]; // floor(min_point3d / resolution)
+            int32_t dim[3];
+            float resolution;
+            float maxDist;
+        };
+
+        // Sample field on the centers of the cells in [min_point3d, max_point3d]
+        GridDistanceField(const DistanceField &field, double resolution,
+                          const octomap::point3d &min_point3d, const octomap::point3d &max_point3d) {
+            initGrid(resolution, field.getMaxDist(), min_point3d, max_point3d);
+
+            int size = dist_data.size();
+            for (int idx = 0; idx < size; idx++) {
+                float distance;
+                octomap::point3d obs;
+                field.getDistanceAndClosestObstacle(getCellCenter(idx), distance, obs);
+                dist_data[idx] = distance;
+                obs_data[idx] = (distance >= 0 && distance < header.maxDist) ? getIndex(obs) : -1;
+            }
+        }
+
+        // Exact EDT of the occupied cells of the octree in [min_point3d, max_point3d].
+        // Separable linear-time algorithm of Felzenszwalb and Huttenlocher, one pass per axis, parallel over lines.
+        GridDistanceField(const octomap::OcTree &octree, float maxDist,
+                          const octomap::point3d &min_point3d, const octomap::point3d &max_point3d,
+                          int num_threads) {
+            double resolution = octree.getResolution();
+            initGrid(resolution, maxDist, min_point3d, max_point3d);
+            const int *dim = header.dim;
+            int size = dist_data.size();
+
+            // Squared distance in cells and the closest obstacle cell, initialized with the occupied cells
+            std::vector<float> sq_dist(size, SP_INFINITY);
+            std::fill(obs_data.begin(), obs_data.end(), -1);
+            for (auto it = octree.begin_leafs_bbx(min_point3d, max_point3d), end = octree.end_leafs_bbx();
+                 it != end; ++it) {
+                if (!octree.isNodeOccupied(*it)) {
+                    continue;
+                }
+                octomap::point3d center = it.getCoordinate();
+                int leaf_size = std::max<int>((int) round(it.getSize() / resolution), 1);
+                int key_lo[3], key_hi[3];
+                for (int i = 0; i < 3; i++) {
+                    int lo = (int) floor((center(i) - it.getSize() / 2) / resolution + 0.5) - header.key_min[i];
+                    key_lo[i] = std::max(lo, 0);
+                    key_hi[i] = std::min(lo + leaf_size, dim[i]);
+                }
+                for (int z = key_lo[2]; z < key_hi[2]; z++) {
+                    for (int y = key_lo[1]; y < key_hi[1]; y++) {
+                        for (int x = key_lo[0]; x < key_hi[0]; x++) {
+                            int idx = (z * dim[1] + y) * dim[0] + x;
+                            sq_dist[idx] = 0;
+                            obs_data[idx] = idx;
+                        }
+                    }
+                }
+            }
+
+            // 1D transforms along x, y, z
+            int stride[3] = {1, dim[0], dim[0] * dim[1]};
+            for (int axis = 0; axis < 3; axis++) {
+                int u = (axis + 1) % 3;
+                int v = (axis + 2) % 3;
+                int n = dim[axis];
+                parallel_for(dim[v], num_threads, [&](int j, int tid) {
+                    std::vector<float> buffer(2 * n + 1);
+                    std::vector<int> vertex(n), site(n);
+                    for (int i = 0; i < dim[u]; i++) {
+                        int base = i * stride[u] + j * stride[v];
+                        transformLine(&sq_dist[base], &obs_data[base], stride[axis], n,
+                                      buffer.data(), vertex.data(), site.data());
+                    }
+                });
+            }
+
+            for (int idx = 0; idx < size; idx++) {
+                float distance = sqrt(sq_dist[idx]) * resolution;
+                if (distance < maxDist) {
+                    dist_data[idx] = distance;
+                } else {
+                    dist_data[idx] = maxDist;
+                    obs_data[idx] = -1;
+                }
+            }
+        }
+
+        ~GridDistanceField() override {
+            if (mapped != nullptr) {
+                munmap(mapped, mapped_size);
+            }
+        }
+
+        GridDistanceField(const GridDistanceField &) = delete;
+        GridDistanceField &operator=(const GridDistanceField &) = delete;
+
+        // Memory-map the grid from the file, nullptr if the file does not exist or does not match hash
+        static std::shared_ptr<GridDistanceField> load(const std::string &path, uint64_t hash) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return nullptr;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+                close(fd);
+                return nullptr;
+            }
+            void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED) {
+                return nullptr;
+            }
+
+            std::shared_ptr<GridDistanceField> grid(new GridDistanceField());
+            grid->mapped = mapped;
+            grid->mapped_size = st.st_size;
+            std::memcpy(&grid->header, mapped, sizeof(Header));
+            const Header &header = grid->header;
+            size_t size = (size_t) header.dim[0] * header.dim[1] * header.dim[2];
+            if (std::memcmp(header.magic, "SPEDT01", 8) != 0 || header.hash != hash ||
+                st.st_size != (off_t) (sizeof(Header) + size * (sizeof(float) + sizeof(int32_t)))) {
+                return nullptr;
+            }
+            grid->dist = reinterpret_cast<const float *>(static_cast<const char *>(mapped) + sizeof(Header));
+            grid->obs_cell = reinterpret_cast<const int32_t *>(grid->dist + size);
+            return grid;
+        }
+
+        // Write to a temporary file and rename it, so that a partially written file is never loaded
+        bool save(const std::string &path, uint64_t hash) {
+            header.hash = hash;
+            size_t size = (size_t) header.dim[0] * header.dim[1] * header.dim[2];
+            std::string tmp_path = path + ".tmp";
+            {
+                std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+                if (!file) {
+                    return false;
+                }
+                file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+                file.write(reinterpret_cast<const char *>(dist), size * sizeof(float));
+                file.write(reinterpret_cast<const char *>(obs_cell), size * sizeof(int32_t));
+                if (!file) {
+                    return false;
+                }
+            }
+            return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+        }
+
+        float getDistance(const octomap::point3d &p) const override {
+            int idx = getIndex(p);
+            if (idx < 0) {
+                return -1;
+            }
+            return dist[idx];
+        }
+
+        void getDistanceAndClosestObstacle(const octomap::point3d &p, float &distance,
+                                           octomap::point3d &closestObstacle) const override {
+            int idx = getIndex(p);
+            if (idx < 0) {
+                distance = -1;
+                closestObstacle = noClosestObstacle();
+                return;
+            }
+            distance = dist[idx];
+            closestObstacle = obs_cell[idx] >= 0 ? getCellCenter(obs_cell[idx]) : noClosestObstacle();
+        }
+
+        float getMaxDist() const override {
+            return header.maxDist;
+        }
+
+        // Lattice points are mapped to cells per axis, consecutive cells of a row are copied at once
+        void getDistances(const std::vector<double> &xs, const std::vector<double> &ys,
+                          const std::vector<double> &zs, std::vector<float> *dist_lattice) const override {
+            std::vector<int> ix, iy, iz;
+            getAxisKeys(xs, 0, &ix);
+            getAxisKeys(ys, 1, &iy);
+            getAxisKeys(zs, 2, &iz);
+
+            int nx = xs.size();
+            dist_lattice->resize(xs.size() * ys.size() * zs.size());
+            float *out = dist_lattice->data();
+            for (int k : iz) {
+                for (int j : iy) {
+                    if (k < 0 || j < 0) {
+                        std::fill(out, out + nx, -1.0f);
+                        out += nx;
+                        continue;
+                    }
+                    int base = (k * header.dim[1] + j) * header.dim[0];
+                    for (int i = 0; i < nx;) {
+                        if (ix[i] < 0) {
+                            *out++ = -1;
+                            i++;
+                            continue;
+                        }
+                        int run = getRun(ix, i);
+                        std::memcpy(out, dist + base + ix[i], run * sizeof(float));
+                        out += run;
+                        i += run;
+                    }
+                }
+            }
+        }
+
+        bool isAnyBelow(const std::vector<double> &xs, const std::vector<double> &ys,
+                        const std::vector<double> &zs, float threshold) const override {
+            std::vector<int> ix, iy, iz;
+            getAxisKeys(xs, 0, &ix);
+            getAxisKeys(ys, 1, &iy);
+            getAxisKeys(zs, 2, &iz);
+
+            bool outside_below = -1 < threshold; // points out of the map have distance -1
+            int nx = xs.size();
+            for (int k : iz) {
+                for (int j : iy) {
+                    if (k < 0 || j < 0) {
+                        if (outside_below && nx > 0) {
+                            return true;
+                        }
+                        continue;
+                    }
+                    int base = (k * header.dim[1] + j) * header.dim[0];
+                    for (int i = 0; i < nx;) {
+                        if (ix[i] < 0) {
+                            if (outside_below) {
+                                return true;
+                            }
+                            i++;
+                            continue;
+                        }
+                        int run = getRun(ix, i);
+                        if (isRunBelow(dist + base + ix[i], run, threshold)) {
+                            return true;
+                        }
+                        i += run;
+                    }
+                }
+            }
+            return false;
+        }
+
+    private:
+        Header header;
+        const float *dist = nullptr;
+        const int32_t *obs_cell = nullptr;
+        std::vector<float> dist_data;
+        std::vector<int32_t> obs_data;
+        void *mapped = nullptr;
+        size_t mapped_size = 0;
+
+        GridDistanceField() = default;
+
+        void initGrid(double resolution, float maxDist,
+                      const octomap::point3d &min_point3d, const octomap::point3d &max_point3d) {
+            std::memcpy(header.magic, "SPEDT01", 8);
+            header.hash = 0;
+            header.resolution = resolution;
+            header.maxDist = maxDist;
+            for (int i = 0; i < 3; i++) {
+                header.key_min[i] = (int32_t) floor(min_point3d(i) / resolution);
+                header.dim[i] = (int32_t) floor(max_point3d(i) / resolution) - header.key_min[i] + 1;
+            }
+
+            int size = header.dim[0] * header.dim[1] * header.dim[2];
+            dist_data.resize(size);
+            obs_data.resize(size);
+            dist = dist_data.data();
+            obs_cell = obs_data.data();
+        }
+
+        // Cell index of the coordinate along the axis, -1 if it is out of the grid
+        int getAxisKey(double coord, int axis) const {
+            int key = (int) floor(coord * (1.0 / header.resolution)) - header.key_min[axis];
+            if (key < 0 || key >= header.dim[axis]) {
+                return -1;
+            }
+            return key;
+        }
+
+        void getAxisKeys(const std::vector<double> &coords, int axis, std::vector<int> *keys) const {
+            keys->resize(coords.size());
+            for (int i = 0; i < coords.size(); i++) {
+                (*keys)[i] = getAxisKey(coords[i], axis);
+            }
+        }
+
+        // Length of the run of consecutive cells from keys[i]
+        static int getRun(const std::vector<int> &keys, int i) {
+            int run = 1;
+            while (i + run < keys.size() && keys[i + run] == keys[i] + run) {
+                run++;
+            }
+            return run;
+        }
+
+        static bool isRunBelow(const float *d, int n, float threshold) {
+            int i = 0;
+#ifdef __SSE__
+            __m128 t = _mm_set1_ps(threshold);
+            for (; i + 4 <= n; i += 4) {
+                if (_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(d + i), t)) != 0) {
+                    return true;
+                }
+            }
+#endif
+            for (; i < n; i++) {
+                if (d[i] < threshold) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int getIndex(const octomap::point3d &p) const {
+            int key[3];
+            for (int i = 0; i < 3; i++) {
+                key[i] = getAxisKey(p(i), i);
+                if (key[i] < 0) {
+                    return -1;
+                }
+            }
+            return (key[2] * header.dim[1] + key[1]) * header.dim[0] + key[0];
+        }
+
+        octomap::point3d getCellCenter(int idx) const {
+            int key[3];
+            key[0] = idx % header.dim[0];
+            key[1] = (idx / header.dim[0]) % header.dim[1];
+            key[2] = idx / (header.dim[0] * header.dim[1]);
+            octomap::point3d center;
+            for (int i = 0; i < 3; i++) {
+                center(i) = (key[i] + header.key_min[i] + 0.5) * header.resolution;
+            }
+            return center;
+        }
+    };
+
+    // Narrow-band distance field for large worlds. Only the bricks of 8^3 cells within maxDist of obstacles are
+    // kept in a hash map and the distance is saturated at maxDist elsewhere, so that the memory scales with
+    // the obstacle surface rather than the world volume.
+    class BrickDistanceField : public DistanceField {
+    public:
+        static constexpr int BRICK_SHIFT = 3;
+        static constexpr int BRICK_SIZE = 1 << BRICK_SHIFT;
+        static constexpr int BRICK_CELLS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+        // Exact EDT of the occupied cells of the octree in [min_point3d, max_point3d], computed per brick
+        // on a window padded by maxDist, parallel over bricks
+        BrickDistanceField(const octomap::OcTree &octree, float _maxDist,
+                           const octomap::point3d &min_point3d, const octomap::point3d &max_point3d,
+                           int num_threads)
+                : resolution(octree.getResolution()), maxDist(_maxDist) {
+            for (int i = 0; i < 3; i++) {
+                key_min[i] = (int) floor(min_point3d(i) / resolution);
+                key_max[i] = (int) floor(max_point3d(i) / resolution);
+            }
+
+            // Occupied cells, grouped by brick
+            std::unordered_map<uint64_t, std::vector<bool>> occupied;
+            for (auto it = octree.begin_leafs_bbx(min_point3d, max_point3d), end = octree.end_leafs_bbx();
+                 it != end; ++it) {
+                if (!octree.isNodeOccupied(*it)) {
+                    continue;
+                }
+                octomap::point3d center = it.getCoordinate();
+                int leaf_size = std::max<int>((int) round(it.getSize() / resolution), 1);
+                int key_lo[3], key_hi[3];
+                for (int i = 0; i < 3; i++) {
+                    int lo = (int) floor((center(i) - it.getSize() / 2) / resolution + 0.5);
+                    key_lo[i] = std::max(lo, key_min[i]);
+                    key_hi[i] = std::min(lo + leaf_size - 1, key_max[i]);
+                }
+                int key[3];
+                for (key[2] = key_lo[2]; key[2] <= key_hi[2]; key[2]++) {
+                    for (key[1] = key_lo[1]; key[1] <= key_hi[1]; key[1]++) {
+                        for (key[0] = key_lo[0]; key[0] <= key_hi[0]; key[0]++) {
+                            std::vector<bool> &cells = occupied[getBrickKey(key)];
+                            cells.resize((size_t) BRICK_CELLS, false);
+                            cells[getCellOffset(key)] = true;
+                        }
+                    }
+                }
+            }
+
+            // Bricks within maxDist of the occupied bricks
+            int band = (int) ceil(maxDist / resolution);
+            int brick_band = (band + BRICK_SIZE - 1) / BRICK_SIZE;
+            int brick_min[3], brick_max[3];
+            for (int i = 0; i < 3; i++) {
+                brick_min[i] = key_min[i] >> BRICK_SHIFT;
+                brick_max[i] = key_max[i] >> BRICK_SHIFT;
+            }
+            std::vector<uint64_t> band_keys;
+            for (const auto &brick : occupied) {
+                int b[3];
+                decodeBrickKey(brick.first, b);
+                int n[3];
+                for (n[2] = std::max(b[2] - brick_band, brick_min[2]);
+                     n[2] <= std::min(b[2] + brick_band, brick_max[2]); n[2]++) {
+                    for (n[1] = std::max(b[1] - brick_band, brick_min[1]);
+                         n[1] <= std::min(b[1] + brick_band, brick_max[1]); n[1]++) {
+                        for (n[0] = std::max(b[0] - brick_band, brick_min[0]);
+                             n[0] <= std::min(b[0] + brick_band, brick_max[0]); n[0]++) {
+                            band_keys.emplace_back(encodeBrickKey(n));
+                        }
+                    }
+                }
+            }
+            std::sort(band_keys.begin(), band_keys.end());
+            band_keys.erase(std::unique(band_keys.begin(), band_keys.end()), band_keys.end());
+
+            // Obstacles farther than band from a brick can not be closer than maxDist,
+            // so the EDT on the window padded by band is exact within maxDist
+            int w = BRICK_SIZE + 2 * band;
+            // Most band bricks are saturated in open space, so only the others are kept, per thread
+            std::vector<std::vector<std::pair<uint64_t, Brick>>> thread_bricks(getNumThreads(num_threads));
+            parallel_for(band_keys.size(), num_threads, [&](int b, int tid) {
+                int origin[3];
+                decodeBrickKey(band_keys[b], origin);
+                for (int i = 0; i < 3; i++) {
+                    origin[i] = origin[i] * BRICK_SIZE - band;
+                }
+
+                std::vector<float> sq_dist(w * w * w, SP_INFINITY);
+                std::vector<int32_t> obs(w * w * w, -1);
+                int n[3];
+                for (n[2] = origin[2] >> BRICK_SHIFT; n[2] <= (origin[2] + w - 1) >> BRICK_SHIFT; n[2]++) {
+                    for (n[1] = origin[1] >> BRICK_SHIFT; n[1] <= (origin[1] + w - 1) >> BRICK_SHIFT; n[1]++) {
+                        for (n[0] = origin[0] >> BRICK_SHIFT; n[0] <= (origin[0] + w - 1) >> BRICK_SHIFT; n[0]++) {
+                            auto it = occupied.find(encodeBrickKey(n));
+                            if (it == occupied.end()) {
+                                continue;
+                            }
+                            for (int offset = 0; offset < BRICK_CELLS; offset++) {
+                                if (!it->second[offset]) {
+                                    continue;
+                                }
+                                int x = n[0] * BRICK_SIZE + offset % BRICK_SIZE - origin[0];
+                                int y = n[1] * BRICK_SIZE + (offset / BRICK_SIZE) % BRICK_SIZE - origin[1];
+                                int z = n[2] * BRICK_SIZE + offset / (BRICK_SIZE * BRICK_SIZE) - origin[2];
+                                if (x < 0 || x >= w || y < 0 || y >= w || z < 0 || z >= w) {
+                                    continue;
+                                }
+                                int idx = (z * w + y) * w + x;
+                                sq_dist[idx] = 0;
+                                obs[idx] = idx;
+                            }
+                        }
+                    }
+                }
+
+                std::vector<float> buffer(2 * w + 1);
+                std::vector<int> vertex(w), site(w);
+                int stride[3] = {1, w, w * w};
+                for (int axis = 0; axis < 3; axis++) {
+                    int u = (axis + 1) % 3;
+                    int v = (axis + 2) % 3;
+                    for (int j = 0; j < w; j++) {
+                        for (int i = 0; i < w; i++) {
+                            int base = i * stride[u] + j * stride[v];
+                            transformLine(&sq_dist[base], &obs[base], stride[axis], w,
+                                          buffer.data(), vertex.data(), site.data());
+                        }
+                    }
+                }
+
+                Brick brick{};
+                bool saturated = true;
+                for (int offset = 0; offset < BRICK_CELLS; offset++) {
+                    int x = offset % BRICK_SIZE + band;
+                    int y = (offset / BRICK_SIZE) % BRICK_SIZE + band;
+                    int z = offset / (BRICK_SIZE * BRICK_SIZE) + band;
+                    int idx = (z * w + y) * w + x;
+                    float distance = sqrt(sq_dist[idx]) * resolution;
+                    if (distance < maxDist) {
+                        brick.dist[offset] = distance;
+                        brick.obs[offset][0] = obs[idx] % w - x;
+                        brick.obs[offset][1] = (obs[idx] / w) % w - y;
+                        brick.obs[offset][2] = obs[idx] / (w * w) - z;
+                        saturated = false;
+                    } else {
+                        brick.dist[offset] = maxDist;
+                        brick.obs[offset][0] = NO_OBSTACLE;
+                    }
+                }
+                if (!saturated) {
+                    thread_bricks[tid].emplace_back(band_keys[b], brick);
+                }
+            });
+
+            size_t num_bricks = 0;
+            for (const auto &kept : thread_bricks) {
+                num_bricks += kept.size();
+            }
+            bricks.reserve(num_bricks);
+            for (auto &kept : thread_bricks) {
+                for (const auto &brick : kept) {
+                    brick_index[brick.first] = bricks.size();
+                    bricks.emplace_back(brick.second);
+                }
+                std::vector<std::pair<uint64_t, Brick>>().swap(kept);
+            }
+        }
+
+        float getDistance(const octomap::point3d &p) const override {
+            int key[3];
+            if (!getKey(p, key)) {
+                return -1;
+            }
+            const Brick *brick = findBrick(key);
+            if (brick == nullptr) {
+                return maxDist;
+            }
+            return brick->dist[getCellOffset(key)];
+        }
+
+        void getDistanceAndClosestObstacle(const octomap::point3d &p, float &distance,
+                                           octomap::point3d &closestObstacle) const override {
+            int key[3];
+            if (!getKey(p, key)) {
+                distance = -1;
+                closestObstacle = noClosestObstacle();
+                return;
+            }
+            const Brick *brick = findBrick(key);
+            if (brick == nullptr) {
+                distance = maxDist;
+                closestObstacle = noClosestObstacle();
+                return;
+            }
+            int offset = getCellOffset(key);
+            distance = brick->dist[offset];
+            if (brick->obs[offset][0] == NO_OBSTACLE) {
+                closestObstacle = noClosestObstacle();
+                return;
+            }
+            for (int i = 0; i < 3; i++) {
+                closestObstacle(i) = (key[i] + brick->obs[offset][i] + 0.5) * resolution;
+            }
+        }
+
+        float getMaxDist() const override {
+            return maxDist;
+        }
+
+        size_t getNumBricks() const {
+            return bricks.size();
+        }
+
+    private:
+        static constexpr int16_t NO_OBSTACLE = INT16_MIN;
+        static constexpr int BRICK_KEY_BITS = 21;
+        static constexpr int BRICK_KEY_OFFSET = 1 << (BRICK_KEY_BITS - 1);
+
+        // Distance and the offset of the closest obstacle cell from the cell
+        struct Brick {
+            float dist[BRICK_CELLS];
+            int16_t obs[BRICK_CELLS][3];
+        };
+
+        double resolution;
+        float maxDist;
+        int key_min[3], key_max[3];
+        std::unordered_map<uint64_t, int> brick_index;
+        std::vector<Brick> bricks;
+
+        static uint64_t encodeBrickKey(const int brick[3]) {
+            uint64_t code = 0;
+            for (int i = 2; i >= 0; i--) {
+                code = (code << BRICK_KEY_BITS) | (uint64_t) (brick[i] + BRICK_KEY_OFFSET);
+            }
+            return code;
+        }
+
+        static void decodeBrickKey(uint64_t code, int brick[3]) {
+            for (int i = 0; i < 3; i++) {
+                brick[i] = (int) (code & ((1ULL << BRICK_KEY_BITS) - 1)) - BRICK_KEY_OFFSET;
+                code >>= BRICK_KEY_BITS;
+            }
+        }
+
+        static uint64_t getBrickKey(const int key[3]) {
+            int brick[3] = {key[0] >> BRICK_SHIFT, key[1] >> BRICK_SHIFT, key[2] >> BRICK_SHIFT};
+            return encodeBrickKey(brick);
+        }
+
+        static int getCellOffset(const int key[3]) {
+            int mask = BRICK_SIZE - 1;
+            return ((key[2] & mask) * BRICK_SIZE + (key[1] & mask)) * BRICK_SIZE + (key[0] & mask);
+        }
+
+        // Cell key of p, false if p is out of the map
+        bool getKey(const octomap::point3d &p, int key[3]) const {
+            for (int i = 0; i < 3; i++) {
+                key[i] = (int) floor(p(i) * (1.0 / resolution));
+                if (key[i] < key_min[i] || key[i] > key_max[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const Brick *findBrick(const int key[3]) const {
+            auto it = brick_index.find(getBrickKey(key));
+            if (it == brick_index.end()) {
+                return nullptr;
+            }
+            return &bricks[it->second];
+        }
+    };
+
+    // Version of the cached grids, increase it when the distances computed by either algorithm change
+    const uint32_t EDT_CACHE_VERSION = 1;
+
+    // FNV-1a hash of the cache version, the algorithm (dense EDT or DynamicEDTOctomap), the octree,
+    // the bounds and maxDist, used as the key of the cache file
+    inline uint64_t hashDistanceField(const octomap::OcTree &octree, const octomap::point3d &min_point3d,
+                                      const octomap::point3d &max_point3d, float maxDist, bool dense) {
+        std::ostringstream stream;
+        char algorithm = dense ? 1 : 0;
+        stream.write(reinterpret_cast<const char *>(&EDT_CACHE_VERSION), sizeof(uint32_t));
+        stream.write(&algorithm, 1);
+        octree.writeBinaryConst(stream);
+        stream.write(reinterpret_cast<const char *>(&min_point3d(0)), 3 * sizeof(float));
+        stream.write(reinterpret_cast<const char *>(&max_point3d(0)), 3 * sizeof(float));
+        stream.write(reinterpret_cast<const char *>(&maxDist), sizeof(float));
+
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : stream.str()) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Build the distance field of the octree in the world bounds, by the dense EDT if param.edt_dense,
+    // or only in the narrow band of width maxDist around obstacles if param.edt_narrow_band.
+    // If param.edt_cache, the grid is loaded from param.edt_cache_dir, or computed and saved there.
+    inline std::shared_ptr<DistanceField> buildDistanceField(octomap::OcTree *octree, const Param &param) {
+        float maxDist = param.edt_max_dist;
+        octomap::point3d min_point3d(param.world_x_min, param.world_y_min, param.world_z_min);
+        octomap::point3d max_point3d(param.world_x_max, param.world_y_max, param.world_z_max);
+        if (param.map_continuous) {
+            // Continuous map updates need the incremental update of DynamicEDTOctomap
+            return std::make_shared<EDTDistanceField>(maxDist, octree, min_point3d, max_point3d);
+        }
+        if (param.edt_narrow_band) {
+            auto bricks = std::make_shared<BrickDistanceField>(*octree, maxDist, min_point3d, max_point3d,
+                                                               param.num_threads);
+            ROS_INFO_STREAM("DistanceField: narrow band of " << bricks->getNumBricks() << " bricks");
+            return bricks;
+        }
+        if (!param.edt_cache) {
+            if (param.edt_dense) {
+                return std::make_shared<GridDistanceField>(*octree, maxDist, min_point3d, max_point3d,
+                                                           param.num_threads);
+            }
+            return std::make_shared<EDTDistanceField>(maxDist, octree, min_point3d, max_point3d);
+        }
+
+        uint64_t hash = hashDistanceField(*octree, min_point3d, max_point3d, maxDist, param.edt_dense);
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.edt", (unsigned long long) hash);
+        std::string path = param.edt_cache_dir + "/" + name;
+
+        std::shared_ptr<GridDistanceField> grid = GridDistanceField::load(path, hash);
+        if (grid) {
+            ROS_INFO_STREAM("DistanceField: loaded cache " << path);
+            return grid;
+        }
+
+        if (param.edt_dense) {
+            grid = std::make_shared<GridDistanceField>(*octree, maxDist, min_point3d, max_point3d, param.num_threads);
+        } else {
+            EDTDistanceField edt(maxDist, octree, min_point3d, max_point3d);
+            grid = std::make_shared<GridDistanceField>(edt, octree->getResolution(), min_point3d, max_point3d);
+        }
+        mkdir(param.edt_cache_dir.c_str(), 0755);
+        if (grid->save(path, hash)) {
+            ROS_INFO_STREAM("DistanceField: saved cache " << path);
+        } else {
+            ROS_WARN_STREAM("DistanceField: failed to save cache " << path);
+        }
+        return grid;
+    }
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "init_traj_planner.hpp"
+#include <obstacle_grid.hpp>
+#include <parallel.hpp>
 #include <environment.hpp>
 
 using namespace libMultiRobotPlanning;
@@ -8,18 +10,22 @@ using namespace libMultiRobotPlanning;
 namespace SwarmPlanning {
     class ECBSPlanner : public InitTrajPlanner {
     public:
-        ECBSPlanner(std::shared_ptr<DynamicEDTOctomap> _distmap_obj,
+        // If octree_obj is given, the obstacles are inflated from its occupied leaves instead of sampling the
+        // distance field over the whole grid. Continuous map updates always use the distance field.
+        ECBSPlanner(std::shared_ptr<DistanceField> _distmap_obj,
                     Mission _mission,
-                    Param _param)
+                    Param _param,
+                    const std::shared_ptr<octomap::OcTree> &octree_obj = nullptr)
                 : InitTrajPlanner(std::move(_distmap_obj),
                                   std::move(_mission),
                                   std::move(_param)) {
-            setObstacles();
+            setLayers();
+            setObstacles(octree_obj);
             setWaypoints();
         }
 
         bool update(bool log, SwarmPlanning::PlanResult* planResult_ptr) override {
-            Environment mapf(dimx, dimy, dimz, ecbs_obstacles, ecbs_goalLocations, mission.quad_size,
+            Environment mapf(dimx, dimy, dimz, ecbs_obstacles, agent_layer, ecbs_goalLocations, mission.quad_size,
                              param.grid_xy_res);
             ECBS<State, Action, int, Conflict, Constraints, Environment> ecbs(mapf, param.ecbs_w);
             std::vector<libMultiRobotPlanning::PlanResult<State, Action, int>> solution;
@@ -71,45 +77,149 @@ namespace SwarmPlanning {
             return true;
         }
 
+        bool updateObstacles(const std::vector<double> &region) override {
+            // Grid points closer than the largest r + grid_margin to the changed region
+            double margin = layer_margins.back();
+            int idx_min[3], idx_max[3];
+            double grid_min[3] = {grid_x_min, grid_y_min, grid_z_min};
+            double grid_res[3] = {param.grid_xy_res, param.grid_xy_res, param.grid_z_res};
+            int dim[3] = {dimx, dimy, dimz};
+            for (int i = 0; i < 3; i++) {
+                idx_min[i] = std::max((int) ceil((region[i] - margin - grid_min[i]) / grid_res[i] - SP_EPSILON), 0);
+                idx_max[i] = std::min((int) floor((region[i + 3] + margin - grid_min[i]) / grid_res[i] + SP_EPSILON),
+                                      dim[i] - 1);
+            }
+
+            if (!updateObstacles(idx_min, idx_max)) {
+                return false;
+            }
+            return setWaypoints();
+        }
+
+        bool setStartState(const std::vector<std::vector<double>> &startState) override {
+            mission.startState = startState;
+            return setWaypoints();
+        }
+
     private:
-        std::unordered_set<Location> ecbs_obstacles;
+        // Obstacles are inflated per radius class, so that small agents are not blocked by the margin of large ones
+        std::vector<double> layer_margins; // r + grid_margin of each radius class, ascending
+        std::vector<int> agent_layer; // radius class of each agent
+        std::vector<std::vector<uint8_t>> ecbs_obstacles; // dense occupancy grid per radius class
         std::vector<State> ecbs_startStates;
         std::vector<Location> ecbs_goalLocations;
 
-        // Find the location of obstacles in grid-space
-        bool setObstacles() {
-            double r = 0;
+        void setLayers() {
+            std::vector<double> radii(mission.quad_size.begin(), mission.quad_size.end());
+            std::sort(radii.begin(), radii.end());
+            radii.erase(std::unique(radii.begin(), radii.end()), radii.end());
+
+            // To prevent obstacles from putting between grid points, grid_margin is used
+            for (double r : radii) {
+                layer_margins.emplace_back(r + param.grid_margin);
+            }
+            agent_layer.resize(mission.qn);
             for (int qi = 0; qi < mission.qn; qi++) {
-                if (r < mission.quad_size[qi]) {
-                    r = mission.quad_size[qi];
+                agent_layer[qi] = std::lower_bound(radii.begin(), radii.end(), mission.quad_size[qi]) - radii.begin();
+            }
+            ecbs_obstacles.resize(layer_margins.size());
+        }
+
+        // Find the location of obstacles in grid-space
+        bool setObstacles(const std::shared_ptr<octomap::OcTree> &octree_obj) {
+            if (octree_obj && !param.map_continuous) {
+                for (int l = 0; l < layer_margins.size(); l++) {
+                    ObstacleGrid grid(*octree_obj, layer_margins[l],
+                                      octomap::point3d(param.world_x_min, param.world_y_min, param.world_z_min),
+                                      octomap::point3d(param.world_x_max, param.world_y_max, param.world_z_max),
+                                      param.num_threads);
+                    updateObstacles(grid, l);
                 }
+                return true;
             }
+            int idx_min[3] = {0, 0, 0};
+            int idx_max[3] = {dimx - 1, dimy - 1, dimz - 1};
+            return updateObstacles(idx_min, idx_max);
+        }
 
-            int x, y, z;
-            for (double k = grid_z_min; k < grid_z_max + SP_EPSILON; k += param.grid_z_res) {
-                for (double i = grid_x_min; i < grid_x_max + SP_EPSILON; i += param.grid_xy_res) {
-                    for (double j = grid_y_min; j < grid_y_max + SP_EPSILON; j += param.grid_xy_res) {
-                        octomap::point3d cur_point(i, j, k);
-                        float dist = distmap_obj.get()->getDistance(cur_point);
-                        if (dist < 0) {
-                            return false;
-                        }
+        // Mark the grid points in [idx_min, idx_max] closer than the margin of each layer to obstacles.
+        // The distances are queried once for all layers, parallel over z-slices.
+        bool updateObstacles(const int idx_min[3], const int idx_max[3]) {
+            for (auto &layer : ecbs_obstacles) {
+                layer.resize(dimx * dimy * dimz, 0);
+            }
 
-                        // To prevent obstacles from putting between grid points, grid_margin is used
-                        if (dist < r + param.grid_margin) {
-                            x = (int) round((i - grid_x_min) / param.grid_xy_res);
-                            y = (int) round((j - grid_y_min) / param.grid_xy_res);
-                            z = (int) round((k - grid_z_min) / param.grid_z_res);
-                            ecbs_obstacles.insert(Location(x, y, z));
+            std::vector<double> xs, ys;
+            for (int x = idx_min[0]; x <= idx_max[0]; x++) {
+                xs.emplace_back(grid_x_min + x * param.grid_xy_res);
+            }
+            for (int y = idx_min[1]; y <= idx_max[1]; y++) {
+                ys.emplace_back(grid_y_min + y * param.grid_xy_res);
+            }
+
+            int num_slices = std::max(idx_max[2] - idx_min[2] + 1, 0);
+            std::vector<char> slice_valid(num_slices, true);
+            parallel_for(num_slices, param.num_threads, [&](int slice, int tid) {
+                int z = idx_min[2] + slice;
+                std::vector<double> zs = {grid_z_min + z * param.grid_z_res};
+                std::vector<float> dists;
+                distmap_obj.get()->getDistances(xs, ys, zs, &dists);
+                if (std::any_of(dists.begin(), dists.end(), [](float dist) { return dist < 0; })) {
+                    slice_valid[slice] = false;
+                    return;
+                }
+                for (int l = 0; l < layer_margins.size(); l++) {
+                    int idx = 0;
+                    for (int y = idx_min[1]; y <= idx_max[1]; y++) {
+                        uint8_t *row = &ecbs_obstacles[l][(z * dimy + y) * dimx];
+                        for (int x = idx_min[0]; x <= idx_max[0]; x++) {
+                            row[x] = dists[idx++] < layer_margins[l];
                         }
                     }
                 }
+            });
+            return std::all_of(slice_valid.begin(), slice_valid.end(), [](char valid) { return valid; });
+        }
+
+        // Mark the grid points of the layer in the occupied cells of the inflated obstacle grid,
+        // parallel over z-slices
+        void updateObstacles(const ObstacleGrid &grid, int layer) {
+            std::vector<uint8_t> &obstacles = ecbs_obstacles[layer];
+            obstacles.assign(dimx * dimy * dimz, 0);
+
+            std::vector<int> key_x(dimx), key_y(dimy);
+            for (int x = 0; x < dimx; x++) {
+                key_x[x] = grid.getKey(grid_x_min + x * param.grid_xy_res);
             }
-            return true;
+            for (int y = 0; y < dimy; y++) {
+                key_y[y] = grid.getKey(grid_y_min + y * param.grid_xy_res);
+            }
+            parallel_for(dimz, param.num_threads, [&](int z, int tid) {
+                int key[3];
+                key[2] = grid.getKey(grid_z_min + z * param.grid_z_res);
+                for (int y = 0; y < dimy; y++) {
+                    key[1] = key_y[y];
+                    uint8_t *row = &obstacles[(z * dimy + y) * dimx];
+                    for (int x = 0; x < dimx; x++) {
+                        key[0] = key_x[x];
+                        row[x] = grid.isOccupied(key, key);
+                    }
+                }
+            });
+        }
+
+        bool isObstacle(int qi, int x, int y, int z) const {
+            if (x < 0 || x >= dimx || y < 0 || y >= dimy || z < 0 || z >= dimz) {
+                return false;
+            }
+            return ecbs_obstacles[agent_layer[qi]][(z * dimy + y) * dimx + x] != 0;
         }
 
         // Set start, goal points of ECBS
         bool setWaypoints() {
+            ecbs_startStates.clear();
+            ecbs_goalLocations.clear();
+
             int xig, yig, zig, xfg, yfg, zfg;
             for (int i = 0; i < mission.qn; i++) {
                 // For start, goal point of ECBS, we use the nearest grid point.
@@ -120,11 +230,11 @@ namespace SwarmPlanning {
                 yfg = (int) round((mission.goalState[i][1] - grid_y_min) / param.grid_xy_res);
                 zfg = (int) round((mission.goalState[i][2] - grid_z_min) / param.grid_z_res);
 
-                if (ecbs_obstacles.find(Location(xig, yig, zig)) != ecbs_obstacles.end()) {
+                if (isObstacle(i, xig, yig, zig)) {
                     ROS_ERROR_STREAM("ECBSPlanner: start of agent " << i << " is occluded by obstacle");
                     return false;
                 }
-                if (ecbs_obstacles.find(Location(xfg, yfg, zfg)) != ecbs_obstacles.end()) {
+                if (isObstacle(i, xfg, yfg, zfg)) {
                     ROS_ERROR_STREAM("ECBSPlanner: goal of agent " << i << " is occluded by obstacle");
                     return false;
                 }
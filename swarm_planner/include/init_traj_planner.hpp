@@ -1,7 +1,7 @@
 #pragma once
 
 #include <sp_const.hpp>
-#include <dynamicEDT3D/dynamicEDTOctomap.h>
+#include <distance_field.hpp>
 #include <param.hpp>
 #include <mission.hpp>
 
@@ -10,7 +10,13 @@ namespace SwarmPlanning {
     public:
         virtual bool update(bool log, SwarmPlanning::PlanResult* planResult_ptr) = 0;
 
-        InitTrajPlanner(std::shared_ptr<DynamicEDTOctomap> _distmap_obj,
+        // Update the obstacles in region [x_min, y_min, z_min, x_max, y_max, z_max] after the map is changed
+        virtual bool updateObstacles(const std::vector<double> &region) = 0;
+
+        // Plan the next update from startState, the current states of the agents when replanning
+        virtual bool setStartState(const std::vector<std::vector<double>> &startState) = 0;
+
+        InitTrajPlanner(std::shared_ptr<DistanceField> _distmap_obj,
                         SwarmPlanning::Mission _mission,
                         SwarmPlanning::Param _param)
                 : distmap_obj(std::move(_distmap_obj)),
@@ -30,7 +36,7 @@ namespace SwarmPlanning {
         }
 
     protected:
-        std::shared_ptr<DynamicEDTOctomap> distmap_obj;
+        std::shared_ptr<DistanceField> distmap_obj;
         SwarmPlanning::Mission mission;
         SwarmPlanning::Param param;
 
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <octomap/OcTree.h>
+
+#include <parallel.hpp>
+
+namespace SwarmPlanning {
+    // Occupancy of the octree cells in [min_point3d, max_point3d] inflated by margin. A cell is occupied if the center
+    // of an occupied cell is closer than margin, the same test as DistanceField::getDistance(p) < margin.
+    // It is built by stamping the occupied leaves, so that the cost scales with the obstacles rather than
+    // the world volume, and box queries are answered in O(1) by a summed volume table.
+    class ObstacleGrid {
+    public:
+        ObstacleGrid(const octomap::OcTree &octree, double margin,
+                     const octomap::point3d &min_point3d, const octomap::point3d &max_point3d, int num_threads)
+                : resolution(octree.getResolution()) {
+            for (int i = 0; i < 3; i++) {
+                key_min[i] = (int) floor(min_point3d(i) / resolution);
+                dim[i] = (int) floor(max_point3d(i) / resolution) - key_min[i] + 1;
+            }
+
+            // Cell ranges of the occupied leaves, bucketed by the z-slices they cover after inflation
+            int r = std::max((int) ceil(margin / resolution), 0);
+            std::vector<std::array<int, 6>> leaves;
+            std::vector<std::vector<int>> slice_leaves(dim[2]);
+            for (auto it = octree.begin_leafs_bbx(min_point3d, max_point3d), end = octree.end_leafs_bbx();
+                 it != end; ++it) {
+                if (!octree.isNodeOccupied(*it)) {
+                    continue;
+                }
+                octomap::point3d center = it.getCoordinate();
+                int leaf_size = std::max<int>((int) round(it.getSize() / resolution), 1);
+                std::array<int, 6> leaf;
+                bool empty = false;
+                for (int i = 0; i < 3; i++) {
+                    int lo = (int) floor((center(i) - it.getSize() / 2) / resolution + 0.5) - key_min[i];
+                    leaf[i] = std::max(lo, 0);
+                    leaf[i + 3] = std::min(lo + leaf_size - 1, dim[i] - 1);
+                    empty = empty || leaf[i] > leaf[i + 3];
+                }
+                if (empty) {
+                    continue;
+                }
+                for (int z = std::max(leaf[2] - r, 0); z <= std::min(leaf[5] + r, dim[2] - 1); z++) {
+                    slice_leaves[z].emplace_back(leaves.size());
+                }
+                leaves.emplace_back(leaf);
+            }
+
+            // Stamp the inflated leaves, parallel over z-slices
+            double margin_sq = margin * margin / (resolution * resolution);
+            size_t slice_size = (size_t) dim[0] * dim[1];
+            std::vector<uint8_t> occupied(slice_size * dim[2], 0);
+            parallel_for(dim[2], num_threads, [&](int z, int tid) {
+                uint8_t *slice = &occupied[z * slice_size];
+                for (int l : slice_leaves[z]) {
+                    const std::array<int, 6> &leaf = leaves[l];
+                    int dz = std::max({leaf[2] - z, z - leaf[5], 0});
+                    for (int y = std::max(leaf[1] - r, 0); y <= std::min(leaf[4] + r, dim[1] - 1); y++) {
+                        int dy = std::max({leaf[1] - y, y - leaf[4], 0});
+                        for (int x = std::max(leaf[0] - r, 0); x <= std::min(leaf[3] + r, dim[0] - 1); x++) {
+                            int dx = std::max({leaf[0] - x, x - leaf[3], 0});
+                            if (dx * dx + dy * dy + dz * dz < margin_sq) {
+                                slice[y * dim[0] + x] = 1;
+                            }
+                        }
+                    }
+                }
+            });
+
+            // Summed volume table, 2D prefix sums per z-slice followed by the prefix sum along z
+            sat.assign((size_t) (dim[0] + 1) * (dim[1] + 1) * (dim[2] + 1), 0);
+            parallel_for(dim[2], num_threads, [&](int z, int tid) {
+                for (int y = 0; y < dim[1]; y++) {
+                    int32_t row = 0;
+                    for (int x = 0; x < dim[0]; x++) {
+                        row += occupied[z * slice_size + y * dim[0] + x];
+                        sat[getSatIndex(x + 1, y + 1, z + 1)] = sat[getSatIndex(x + 1, y, z + 1)] + row;
+                    }
+                }
+            });
+            parallel_for(dim[1], num_threads, [&](int y, int tid) {
+                for (int z = 1; z <= dim[2]; z++) {
+                    for (int x = 1; x <= dim[0]; x++) {
+                        sat[getSatIndex(x, y + 1, z)] += sat[getSatIndex(x, y + 1, z - 1)];
+                    }
+                }
+            });
+        }
+
+        // Cell key of the coordinate, the same for every axis
+        int getKey(double coord) const {
+            return (int) floor(coord * (1.0 / resolution));
+        }
+
+        // Whether any cell in the key range [key_lo, key_hi] is occupied, cells out of the map count as occupied
+        bool isOccupied(const int key_lo[3], const int key_hi[3]) const {
+            int lo[3], hi[3];
+            for (int i = 0; i < 3; i++) {
+                lo[i] = key_lo[i] - key_min[i];
+                hi[i] = key_hi[i] - key_min[i] + 1;
+                if (lo[i] >= hi[i]) {
+                    return false;
+                }
+                if (lo[i] < 0 || hi[i] > dim[i]) {
+                    return true;
+                }
+            }
+            int64_t count = (int64_t) sat[getSatIndex(hi[0], hi[1], hi[2])]
+                            - sat[getSatIndex(lo[0], hi[1], hi[2])]
+                            - sat[getSatIndex(hi[0], lo[1], hi[2])]
+                            - sat[getSatIndex(hi[0], hi[1], lo[2])]
+                            + sat[getSatIndex(lo[0], lo[1], hi[2])]
+                            + sat[getSatIndex(lo[0], hi[1], lo[2])]
+                            + sat[getSatIndex(hi[0], lo[1], lo[2])]
+                            - sat[getSatIndex(lo[0], lo[1], lo[2])];
+            return count > 0;
+        }
+
+        bool isOccupied(const octomap::point3d &p) const {
+            int key[3] = {getKey(p.x()), getKey(p.y()), getKey(p.z())};
+            return isOccupied(key, key);
+        }
+
+    private:
+        double resolution;
+        int key_min[3];
+        int dim[3];
+        std::vector<int32_t> sat; // the number of occupied cells in [0, x) x [0, y) x [0, z)
+
+        size_t getSatIndex(int x, int y, int z) const {
+            return ((size_t) z * (dim[1] + 1) + y) * (dim[0] + 1) + x;
+        }
+    };
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SwarmPlanning {
+    // The number of worker threads, num_threads <= 0 means the number of hardware threads
+    inline int getNumThreads(int num_threads) {
+        if (num_threads > 0) {
+            return num_threads;
+        }
+        return std::max<int>(std::thread::hardware_concurrency(), 1);
+    }
+
+    // Work-stealing parallel loop, job(i, tid) is called once for every i in [0, size).
+    // tid in [0, num_threads) is the index of the worker, which can be used to select a per-thread buffer.
+    // [0, size) is split evenly among the workers, each worker takes jobs from the front of its own range,
+    // and steals the back half of the largest remaining range of the other workers when its range is empty.
+    inline void parallel_for(int size, int num_threads, const std::function<void(int, int)> &job) {
+        num_threads = std::min(getNumThreads(num_threads), size);
+        if (num_threads <= 1) {
+            for (int i = 0; i < size; i++) {
+                job(i, 0);
+            }
+            return;
+        }
+
+        struct Range {
+            std::mutex mtx;
+            int begin;
+            int end;
+        };
+        std::vector<Range> ranges(num_threads);
+        for (int tid = 0; tid < num_threads; tid++) {
+            ranges[tid].begin = static_cast<long>(size) * tid / num_threads;
+            ranges[tid].end = static_cast<long>(size) * (tid + 1) / num_threads;
+        }
+
+        auto worker = [&](int tid) {
+            while (true) {
+                int i = -1;
+                {
+                    std::lock_guard<std::mutex> lock(ranges[tid].mtx);
+                    if (ranges[tid].begin < ranges[tid].end) {
+                        i = ranges[tid].begin++;
+                    }
+                }
+                if (i >= 0) {
+                    job(i, tid);
+                    continue;
+                }
+
+                // Find victim
+                int victim = -1;
+                int victim_size = 0;
+                for (int t = 0; t < num_threads; t++) {
+                    if (t == tid) {
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> lock(ranges[t].mtx);
+                    if (ranges[t].end - ranges[t].begin > victim_size) {
+                        victim = t;
+                        victim_size = ranges[t].end - ranges[t].begin;
+                    }
+                }
+                if (victim < 0) {
+                    return;
+                }
+
+                // Steal the back half of the victim's range
+                int steal_begin, steal_end;
+                {
+                    std::lock_guard<std::mutex> lock(ranges[victim].mtx);
+                    int remain = ranges[victim].end - ranges[victim].begin;
+                    if (remain <= 0) {
+                        continue;
+                    }
+                    steal_end = ranges[victim].end;
+                    steal_begin = steal_end - (remain + 1) / 2;
+                    ranges[victim].end = steal_begin;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(ranges[tid].mtx);
+                    ranges[tid].begin = steal_begin;
+                    ranges[tid].end = steal_end;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int tid = 1; tid < num_threads; tid++) {
+            threads.emplace_back(worker, tid);
+        }
+        worker(0);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+}
@@ -9,6 +9,7 @@ namespace SwarmPlanning{
     public:
         bool log;
         std::string package_path;
+        int num_threads; // the number of worker threads, 0: the number of hardware threads
 
         double world_x_min;
         double world_y_min;
@@ -17,6 +18,14 @@ namespace SwarmPlanning{
         double world_y_max;
         double world_z_max;
 
+        double edt_max_dist; // saturation distance of the Euclidean distance field
+        bool edt_dense; // use the in-tree dense EDT instead of DynamicEDTOctomap
+        bool edt_cache; // save distance fields to edt_cache_dir and reuse them
+        bool edt_narrow_band; // keep only the bricks within edt_max_dist of obstacles, for large worlds
+        std::string edt_cache_dir;
+        bool map_continuous; // keep receiving octomap and replan when the map is changed
+        double map_replan_margin; // the predicted replanning time over the last planning runtime
+
         double ecbs_w;
         double grid_xy_res;
         double grid_z_res;
@@ -24,16 +33,24 @@ namespace SwarmPlanning{
 
         double box_xy_res;
         double box_z_res;
+        bool polytope; // use convex polytopes instead of axis-aligned boxes for SFC
+        double polytope_range; // search range of obstacles around the initial trajectory
 
         bool time_scale;
+        int time_refine; // the number of per-segment time refinement passes after the QP
         double time_step;
         double downwash; // downwash coefficient
         int iteration;
+        bool condense; // eliminate the equality constraints of the RBP QP by a nullspace basis
         bool sequential;
         int batch_size; // the number of agents in a batch
         int batch_iter; // the number of batches
+        int batch_alg; // batch grouping algorithm, SP_BATCH_INDEX, SP_BATCH_GREEDY or SP_BATCH_SPECTRAL
         int n; // degree of polynomial
         int phi; // desired derivatives
+        std::string qp_solver; // QP backend, cplex or admm
+        int qp_max_iter; // maximum iterations of the ADMM QP solver
+        double qp_eps; // relative tolerance of the ADMM QP solver
 
         std::vector<std::vector<double>> color;
 
@@ -43,6 +60,7 @@ namespace SwarmPlanning{
 
     bool Param::setROSParam(const ros::NodeHandle &nh) {
         nh.param<bool>("log", log, false);
+        nh.param<int>("num_threads", num_threads, 0);
 
         nh.param<double>("world/x_min", world_x_min, -5);
         nh.param<double>("world/y_min", world_y_min, -5);
@@ -51,6 +69,13 @@ namespace SwarmPlanning{
         nh.param<double>("world/y_max", world_y_max, 5);
         nh.param<double>("world/z_max", world_z_max, 2.5);
 
+        nh.param<double>("edt/max_dist", edt_max_dist, 1.0);
+        nh.param<bool>("edt/dense", edt_dense, false);
+        nh.param<bool>("edt/cache", edt_cache, false);
+        nh.param<bool>("edt/narrow_band", edt_narrow_band, false);
+        nh.param<bool>("map/continuous", map_continuous, false);
+        nh.param<double>("map/replan_margin", map_replan_margin, 1.5);
+
         nh.param<double>("grid/xy_res", grid_xy_res, 0.3);
         nh.param<double>("grid/z_res", grid_z_res, 0.6);
         nh.param<double>("grid/margin", grid_margin, 0.2);
@@ -58,8 +83,11 @@ namespace SwarmPlanning{
 
         nh.param<double>("box/xy_res", box_xy_res, 0.1);
         nh.param<double>("box/z_res", box_z_res, 0.1);
+        nh.param<bool>("box/polytope", polytope, false);
+        nh.param<double>("box/polytope_range", polytope_range, 1.0);
 
         nh.param<bool>("plan/time_scale", time_scale, true);
+        nh.param<int>("plan/time_refine", time_refine, 0);
         nh.param<double>("plan/time_step", time_step, 1);
         nh.param<double>("plan/downwash", downwash, 2.0);
         nh.param<int>("plan/n", n, 5);
@@ -67,9 +95,20 @@ namespace SwarmPlanning{
         nh.param<bool>("plan/sequential", sequential, false);
         nh.param<int>("plan/batch_size", batch_size, 4);
         nh.param<int>("plan/batch_iter", batch_iter, 0);
+        nh.param<int>("plan/batch_alg", batch_alg, SP_BATCH_INDEX);
         nh.param<int>("plan/iteration", iteration, 1);
+        nh.param<bool>("plan/condense", condense, false);
+
+#ifdef SWARM_PLANNER_USE_CPLEX
+        nh.param<std::string>("qp/solver", qp_solver, "cplex");
+#else
+        nh.param<std::string>("qp/solver", qp_solver, "admm");
+#endif
+        nh.param<int>("qp/max_iter", qp_max_iter, 10000);
+        nh.param<double>("qp/eps", qp_eps, 1e-5);
 
         package_path = ros::package::getPath("swarm_planner");
+        nh.param<std::string>("edt/cache_dir", edt_cache_dir, package_path + "/worlds/edt_cache");
 
         return true;
     }
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+namespace SwarmPlanning {
+    const double QP_INFINITY = 1e20; // bounds beyond this are infinite, the same as CPX_INFBOUND
+
+    // Sparse QP in solver-facing form
+    // min  x'Qx + c'x
+    // s.t. row_lower <= Ax <= row_upper
+    //      col_lower <= x <= col_upper
+    // Q is symmetric, Q and A are compressed sparse column matrices. c may be empty, which means zero.
+    struct QPProblem {
+        Eigen::SparseMatrix<double> Q;
+        Eigen::VectorXd c;
+        Eigen::SparseMatrix<double> A;
+        Eigen::VectorXd row_lower, row_upper;
+        Eigen::VectorXd col_lower, col_upper;
+        int num_eq = 0; // the number of equality rows, which come first in A
+
+        int cols() const {
+            return A.cols();
+        }
+
+        int rows() const {
+            return A.rows();
+        }
+    };
+
+    // Row-wise triplet buffer for QPProblem::A
+    class QPRowBuilder {
+    public:
+        explicit QPRowBuilder(int _cols) : cols(_cols) {
+        }
+
+        // Append the row lower <= sum(val[i] * x[col[i]]) <= upper, returns the index of the row
+        int addRow(const std::vector<int> &col, const std::vector<double> &val, double lower, double upper) {
+            int row = lower_bounds.size();
+            for (int i = 0; i < col.size(); i++) {
+                if (val[i] != 0) {
+                    triplets.emplace_back(Eigen::Triplet<double>(row, col[i], val[i]));
+                }
+            }
+            lower_bounds.emplace_back(lower);
+            upper_bounds.emplace_back(upper);
+            return row;
+        }
+
+        void build(QPProblem *qp) const {
+            int rows = lower_bounds.size();
+            qp->A.resize(rows, cols);
+            qp->A.setFromTriplets(triplets.begin(), triplets.end());
+            qp->A.makeCompressed();
+            qp->row_lower = Eigen::Map<const Eigen::VectorXd>(lower_bounds.data(), rows);
+            qp->row_upper = Eigen::Map<const Eigen::VectorXd>(upper_bounds.data(), rows);
+        }
+
+        int rows() const {
+            return lower_bounds.size();
+        }
+
+    private:
+        int cols;
+        std::vector<Eigen::Triplet<double>> triplets;
+        std::vector<double> lower_bounds, upper_bounds;
+    };
+}
@@ -0,0 +1,589 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+
+#include <ros/ros.h>
+
+#ifdef SWARM_PLANNER_USE_CPLEX
+#include <ilcplex/cplex.h>
+#endif
+
+#include <param.hpp>
+#include <qp_problem.hpp>
+
+namespace SwarmPlanning {
+    // QP backend
+    class QPSolver {
+    public:
+        virtual ~QPSolver() = default;
+
+        // Solve qp, x is used as the initial guess if it has the right size, and holds the solution on return.
+        // obj is the optimal value of x'Qx + c'x.
+        virtual bool solve(const QPProblem &qp, Eigen::VectorXd *x, double *obj) = 0;
+
+        // Solve qp which differs from the last solved problem only in the bounds of the rows given by their indices.
+        // The backends update the model of the last solve in place and warm start from its solution.
+        virtual bool resolve(const QPProblem &qp, const std::vector<int> &, Eigen::VectorXd *x, double *obj) {
+            return solve(qp, x, obj);
+        }
+    };
+
+#ifdef SWARM_PLANNER_USE_CPLEX
+    // CPLEX callable library, the sparse matrices are copied in bulk.
+    // The problem of the last solve is kept, resolve changes the given row bounds and CPLEX starts from the last basis.
+    class CplexQPSolver : public QPSolver {
+    public:
+        // If export_path is not empty, the model is written to the file before solving.
+        // threads limits the CPLEX threads, 0 lets CPLEX use all cores.
+        CplexQPSolver(bool _log, std::string _export_path, int _threads)
+                : log(_log), export_path(std::move(_export_path)), threads(_threads) {
+        }
+
+        ~CplexQPSolver() override {
+            if (lp != nullptr) {
+                CPXfreeprob(env, &lp);
+            }
+            if (env != nullptr) {
+                CPXcloseCPLEX(&env);
+            }
+        }
+
+        bool solve(const QPProblem &qp, Eigen::VectorXd *x, double *obj) override {
+            int status = 0;
+            if (env == nullptr) {
+                env = CPXopenCPLEX(&status);
+                if (env == nullptr) {
+                    ROS_ERROR("QPSolver: Failed to open CPLEX environment");
+                    return false;
+                }
+                CPXsetintparam(env, CPXPARAM_ScreenOutput, log ? CPX_ON : CPX_OFF);
+                if (threads > 0) {
+                    CPXsetintparam(env, CPXPARAM_Threads, threads);
+                }
+            }
+            if (lp != nullptr) {
+                CPXfreeprob(env, &lp);
+            }
+            lp = CPXcreateprob(env, &status, "QP");
+            if (lp == nullptr) {
+                ROS_ERROR("QPSolver: Failed to create CPLEX problem");
+                return false;
+            }
+
+            int rows = qp.rows();
+            int cols = qp.cols();
+            std::vector<double> rhs(rows), rngval(rows), obj_lin(cols, 0);
+            std::vector<char> sense(rows);
+            for (int r = 0; r < rows; r++) {
+                getRowSense(qp.row_lower(r), qp.row_upper(r), &rhs[r], &rngval[r], &sense[r]);
+            }
+            if (qp.c.size() == cols) {
+                std::copy(qp.c.data(), qp.c.data() + cols, obj_lin.begin());
+            }
+            std::vector<int> matcnt(cols);
+            for (int c = 0; c < cols; c++) {
+                matcnt[c] = qp.A.outerIndexPtr()[c + 1] - qp.A.outerIndexPtr()[c];
+            }
+
+            // CPLEX minimizes 1/2 x'Qx
+            Eigen::SparseMatrix<double> Q2 = 2 * qp.Q;
+            Q2.makeCompressed();
+            std::vector<int> qmatcnt(cols);
+            for (int c = 0; c < cols; c++) {
+                qmatcnt[c] = Q2.outerIndexPtr()[c + 1] - Q2.outerIndexPtr()[c];
+            }
+
+            status = CPXcopylp(env, lp, cols, rows, CPX_MIN, obj_lin.data(), rhs.data(), sense.data(),
+                               qp.A.outerIndexPtr(), matcnt.data(), qp.A.innerIndexPtr(), qp.A.valuePtr(),
+                               qp.col_lower.data(), qp.col_upper.data(), rngval.data());
+            if (status == 0) {
+                status = CPXcopyquad(env, lp, Q2.outerIndexPtr(), qmatcnt.data(), Q2.innerIndexPtr(), Q2.valuePtr());
+            }
+            if (status == 0 && x->size() == cols) {
+                CPXcopystart(env, lp, nullptr, nullptr, x->data(), nullptr, nullptr, nullptr);
+            }
+            return optimize(status, x, obj);
+        }
+
+        bool resolve(const QPProblem &qp, const std::vector<int> &rows, Eigen::VectorXd *x, double *obj) override {
+            if (lp == nullptr || CPXgetnumrows(env, lp) != qp.rows() || CPXgetnumcols(env, lp) != qp.cols()) {
+                return solve(qp, x, obj);
+            }
+
+            int cnt = rows.size();
+            std::vector<double> rhs(cnt), rngval(cnt);
+            std::vector<char> sense(cnt);
+            for (int i = 0; i < cnt; i++) {
+                getRowSense(qp.row_lower(rows[i]), qp.row_upper(rows[i]), &rhs[i], &rngval[i], &sense[i]);
+            }
+
+            int status = 0;
+            if (cnt > 0) {
+                status = CPXchgsense(env, lp, cnt, rows.data(), sense.data());
+                if (status == 0) {
+                    status = CPXchgrhs(env, lp, cnt, rows.data(), rhs.data());
+                }
+                if (status == 0) {
+                    status = CPXchgrngval(env, lp, cnt, rows.data(), rngval.data());
+                }
+            }
+            return optimize(status, x, obj);
+        }
+
+    private:
+        bool log;
+        std::string export_path;
+        int threads;
+        CPXENVptr env = nullptr;
+        CPXLPptr lp = nullptr;
+
+        // Ranged rows: E (equal), L (upper bound only), G (lower bound only), R (both)
+        static void getRowSense(double lower, double upper, double *rhs, double *rngval, char *sense) {
+            *rngval = 0;
+            if (lower == upper) {
+                *sense = 'E';
+                *rhs = lower;
+            } else if (lower <= -QP_INFINITY) {
+                *sense = 'L';
+                *rhs = upper;
+            } else if (upper >= QP_INFINITY) {
+                *sense = 'G';
+                *rhs = lower;
+            } else {
+                *sense = 'R';
+                *rhs = lower;
+                *rngval = upper - lower;
+            }
+        }
+
+        bool optimize(int status, Eigen::VectorXd *x, double *obj) {
+            if (status == 0 && !export_path.empty()) {
+                CPXwriteprob(env, lp, export_path.c_str(), nullptr);
+            }
+            if (status == 0) {
+                status = CPXqpopt(env, lp);
+            }
+
+            int solstat = 0;
+            x->resize(CPXgetnumcols(env, lp));
+            if (status == 0) {
+                status = CPXsolution(env, lp, &solstat, obj, x->data(), nullptr, nullptr, nullptr);
+            }
+            if (status != 0) {
+                char buffer[CPXMESSAGEBUFSIZE];
+                if (CPXgeterrorstring(env, status, buffer) != nullptr) {
+                    ROS_ERROR_STREAM("QPSolver: CPLEX error: " << buffer);
+                }
+            }
+            return status == 0 && (solstat == CPX_STAT_OPTIMAL || solstat == CPX_STAT_OPTIMAL_INFEAS);
+        }
+    };
+#endif
+
+    // Operator splitting (ADMM) QP solver in the form of OSQP.
+    // The problem is equilibrated by Ruiz scaling, and the constraints l <= Cx <= u stack the rows of A and
+    // the variables with finite bounds. Each iteration solves the quasi-definite system
+    // (P + sigma I + C' diag(rho) C) x = rhs by a sparse LDL' factorization, which is reused until rho changes.
+    // The fill-reducing ordering keeps the factor of the block diagonal cost and the banded continuity
+    // constraints of each agent sparse. The scaled problem, the factorization and the dual variables of the
+    // last solve are kept, so that resolve only rescales the changed bounds and warm starts from the last solution.
+    // The iterate is polished on its active set, and it is accepted only if the duality gap is small as well,
+    // since the residuals alone stop early on the ill-conditioned QP of a long trajectory.
+    class ADMMQPSolver : public QPSolver {
+    public:
+        ADMMQPSolver(int _max_iter, double _eps, bool _log)
+                : max_iter(_max_iter), eps(_eps), log(_log) {
+        }
+
+        bool solve(const QPProblem &qp, Eigen::VectorXd *x_ptr, double *obj) override {
+            n = qp.cols();
+
+            // Constraint matrix C = [A; I_bounded]
+            bounded.clear();
+            for (int j = 0; j < n; j++) {
+                if (qp.col_lower(j) > -QP_INFINITY || qp.col_upper(j) < QP_INFINITY) {
+                    bounded.emplace_back(j);
+                }
+            }
+            m = qp.rows() + bounded.size();
+            std::vector<Eigen::Triplet<double>> triplets;
+            triplets.reserve(qp.A.nonZeros() + bounded.size());
+            for (int j = 0; j < n; j++) {
+                for (Eigen::SparseMatrix<double>::InnerIterator it(qp.A, j); it; ++it) {
+                    triplets.emplace_back(Eigen::Triplet<double>(it.row(), j, it.value()));
+                }
+            }
+            for (int b = 0; b < bounded.size(); b++) {
+                triplets.emplace_back(Eigen::Triplet<double>(qp.rows() + b, bounded[b], 1));
+            }
+            C.resize(m, n);
+            C.setFromTriplets(triplets.begin(), triplets.end());
+            P = 2 * qp.Q;
+            q = qp.c.size() == n ? qp.c : Eigen::VectorXd::Zero(n);
+
+            // Ruiz equilibration, P <- cost_scale * D P D, q <- cost_scale * D q, C <- E C D, l, u <- E l, E u
+            D = Eigen::VectorXd::Ones(n);
+            E = Eigen::VectorXd::Ones(m);
+            for (int iter = 0; iter < 10; iter++) {
+                Eigen::VectorXd d = Eigen::VectorXd::Zero(n);
+                Eigen::VectorXd e = Eigen::VectorXd::Zero(m);
+                for (int j = 0; j < n; j++) {
+                    for (Eigen::SparseMatrix<double>::InnerIterator it(P, j); it; ++it) {
+                        d(j) = std::max(d(j), std::abs(it.value()));
+                    }
+                    for (Eigen::SparseMatrix<double>::InnerIterator it(C, j); it; ++it) {
+                        d(j) = std::max(d(j), std::abs(it.value()));
+                        e(it.row()) = std::max(e(it.row()), std::abs(it.value()));
+                    }
+                }
+                d = d.unaryExpr([](double v) { return v < 1e-4 ? 1.0 : 1 / std::sqrt(v); });
+                e = e.unaryExpr([](double v) { return v < 1e-4 ? 1.0 : 1 / std::sqrt(v); });
+                P = d.asDiagonal() * P * d.asDiagonal();
+                C = e.asDiagonal() * C * d.asDiagonal();
+                q = d.cwiseProduct(q);
+                D = D.cwiseProduct(d);
+                E = E.cwiseProduct(e);
+            }
+            double mean_col = 0;
+            for (int j = 0; j < n; j++) {
+                double col = 0;
+                for (Eigen::SparseMatrix<double>::InnerIterator it(P, j); it; ++it) {
+                    col = std::max(col, std::abs(it.value()));
+                }
+                mean_col += col / n;
+            }
+            cost_scale = std::max(mean_col, q.lpNorm<Eigen::Infinity>());
+            cost_scale = cost_scale < 1e-4 ? 1.0 : 1 / cost_scale;
+            P *= cost_scale;
+            q *= cost_scale;
+            P.makeCompressed();
+            C.makeCompressed();
+            Ct = C.transpose();
+
+            setBounds(qp);
+            if (!factorize()) {
+                ROS_ERROR("QPSolver: ADMM factorization failed");
+                ready = false;
+                return false;
+            }
+            ready = true;
+            return iterate(qp, x_ptr, obj);
+        }
+
+        bool resolve(const QPProblem &qp, const std::vector<int> &rows, Eigen::VectorXd *x_ptr,
+                     double *obj) override {
+            if (!ready || qp.cols() != n || qp.rows() + bounded.size() != m) {
+                return solve(qp, x_ptr, obj);
+            }
+            std::vector<char> row_type_prev = row_type;
+            for (int r : rows) {
+                setBound(r, qp.row_lower(r), qp.row_upper(r));
+            }
+            if (row_type != row_type_prev && !factorize()) {
+                ROS_ERROR("QPSolver: ADMM factorization failed");
+                ready = false;
+                return false;
+            }
+            return iterate(qp, x_ptr, obj);
+        }
+
+    private:
+        const double SIGMA = 1e-6;
+        const double ALPHA = 1.6;
+        const double RHO_MIN = 1e-6;
+        const double RHO_MAX = 1e6;
+        const double EQ_RHO_SCALE = 1e3; // equality rows are stiffer
+        const int CHECK_INTERVAL = 25;
+        const int POLISH_INTERVAL = 200;
+        const double POLISH_DELTA = 1e-7; // regularization of the polish KKT system with dependent active rows
+        const int POLISH_REFINE = 3; // iterative refinement steps of the polish
+        enum RowType : char { FREE_ROW, INEQ_ROW, EQ_ROW };
+
+        int max_iter;
+        double eps;
+        bool log;
+
+        // Scaled problem of the last solve
+        bool ready = false;
+        int n = 0, m = 0;
+        std::vector<int> bounded; // variables with finite bounds
+        Eigen::SparseMatrix<double> P, C, Ct;
+        Eigen::VectorXd q, l, u, D, E;
+        double cost_scale = 1;
+        std::vector<char> row_type;
+        Eigen::VectorXd rho_vec;
+        Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt;
+        Eigen::VectorXd y_prev; // unscaled dual of the last solve
+        double rho = 0.1;
+
+        // Scaled bounds l, u of the constraints and their types
+        void setBounds(const QPProblem &qp) {
+            l.resize(m);
+            u.resize(m);
+            row_type.resize(m);
+            for (int r = 0; r < qp.rows(); r++) {
+                setBound(r, qp.row_lower(r), qp.row_upper(r));
+            }
+            for (int b = 0; b < bounded.size(); b++) {
+                setBound(qp.rows() + b, qp.col_lower(bounded[b]), qp.col_upper(bounded[b]));
+            }
+        }
+
+        void setBound(int i, double lower, double upper) {
+            l(i) = lower > -QP_INFINITY ? lower * E(i) : lower;
+            u(i) = upper < QP_INFINITY ? upper * E(i) : upper;
+            if (l(i) <= -QP_INFINITY && u(i) >= QP_INFINITY) {
+                row_type[i] = FREE_ROW;
+            } else if (u(i) - l(i) < 1e-8) {
+                row_type[i] = EQ_ROW;
+            } else {
+                row_type[i] = INEQ_ROW;
+            }
+        }
+
+        bool factorize() {
+            rho_vec.resize(m);
+            for (int i = 0; i < m; i++) {
+                if (row_type[i] == FREE_ROW) {
+                    rho_vec(i) = RHO_MIN;
+                } else if (row_type[i] == EQ_ROW) {
+                    rho_vec(i) = EQ_RHO_SCALE * rho;
+                } else {
+                    rho_vec(i) = rho;
+                }
+            }
+            Eigen::SparseMatrix<double> K = P + Ct * rho_vec.asDiagonal() * C;
+            for (int j = 0; j < n; j++) {
+                K.coeffRef(j, j) += SIGMA;
+            }
+            ldlt.compute(K);
+            return ldlt.info() == Eigen::Success;
+        }
+
+        // Residuals of the unscaled problem at (x, y) of the scaled one, z is the projection of Cx.
+        // The primal and dual residuals relative to the norms of their terms can both be small while x is
+        // far from the optimum of an ill-conditioned problem, so the duality gap x'Px + q'x + support(y),
+        // which bounds the suboptimality of the objective, has to be small as well.
+        bool isOptimal(const Eigen::VectorXd &x, const Eigen::VectorXd &y,
+                       double *prim_res, double *dual_res, double *gap) const {
+            Eigen::VectorXd Cx = C * x;
+            Eigen::VectorXd z = Cx.cwiseMax(l).cwiseMin(u);
+            Eigen::VectorXd y_bounded = y;
+            double support = 0, support_norm = 0;
+            for (int i = 0; i < m; i++) {
+                if ((y(i) > 0 && u(i) >= QP_INFINITY) || (y(i) < 0 && l(i) <= -QP_INFINITY)) {
+                    y_bounded(i) = 0;
+                } else if (y(i) != 0) {
+                    support += y(i) * (y(i) > 0 ? u(i) : l(i));
+                    support_norm += std::abs(y(i) * (y(i) > 0 ? u(i) : l(i)));
+                }
+            }
+            Eigen::VectorXd Px = P * x;
+            Eigen::VectorXd Cty = Ct * y_bounded;
+            *prim_res = (Cx - z).cwiseQuotient(E).lpNorm<Eigen::Infinity>();
+            *dual_res = (Px + q + Cty).cwiseQuotient(D).lpNorm<Eigen::Infinity>() / cost_scale;
+            *gap = std::abs(x.dot(Px) + q.dot(x) + support) / cost_scale;
+            double prim_norm = std::max(Cx.cwiseQuotient(E).lpNorm<Eigen::Infinity>(),
+                                        z.cwiseQuotient(E).lpNorm<Eigen::Infinity>());
+            double dual_norm = std::max({Px.cwiseQuotient(D).lpNorm<Eigen::Infinity>(),
+                                         Cty.cwiseQuotient(D).lpNorm<Eigen::Infinity>(),
+                                         q.cwiseQuotient(D).lpNorm<Eigen::Infinity>()}) / cost_scale;
+            double gap_norm = std::max({std::abs(x.dot(Px)), std::abs(q.dot(x)), support_norm}) / cost_scale;
+            return *prim_res <= eps * (1 + prim_norm) && *dual_res <= eps * (1 + dual_norm) &&
+                   *gap <= eps * (1 + gap_norm);
+        }
+
+        // Solution polishing of OSQP. The rows whose bound is active at the ADMM iterate (z, y) are taken as
+        // equalities and the KKT system [P, C_A'; C_A, 0] of the scaled problem is solved with iterative
+        // refinement. The caller accepts the result only if it passes isOptimal.
+        bool polish(const Eigen::VectorXd &z, const Eigen::VectorXd &y, Eigen::VectorXd *x_polish,
+                    Eigen::VectorXd *y_polish) const {
+            std::vector<int> active;
+            std::vector<double> target;
+            for (int i = 0; i < m; i++) {
+                if (row_type[i] == EQ_ROW) {
+                    active.emplace_back(i);
+                    target.emplace_back(l(i));
+                } else if (row_type[i] == INEQ_ROW && z(i) - l(i) < -y(i)) {
+                    active.emplace_back(i);
+                    target.emplace_back(l(i));
+                } else if (row_type[i] == INEQ_ROW && u(i) - z(i) < y(i)) {
+                    active.emplace_back(i);
+                    target.emplace_back(u(i));
+                }
+            }
+            int a = active.size();
+
+            std::vector<Eigen::Triplet<double>> triplets;
+            triplets.reserve(P.nonZeros() + 2 * C.nonZeros() + n + a);
+            for (int j = 0; j < n; j++) {
+                for (Eigen::SparseMatrix<double>::InnerIterator it(P, j); it; ++it) {
+                    triplets.emplace_back(Eigen::Triplet<double>(it.row(), j, it.value()));
+                }
+                triplets.emplace_back(Eigen::Triplet<double>(j, j, 0));
+            }
+            Eigen::SparseMatrix<double> C_active(a, n);
+            {
+                std::vector<Eigen::Triplet<double>> active_triplets;
+                for (int r = 0; r < a; r++) {
+                    for (Eigen::SparseMatrix<double>::InnerIterator it(Ct, active[r]); it; ++it) {
+                        active_triplets.emplace_back(Eigen::Triplet<double>(r, it.row(), it.value()));
+                        triplets.emplace_back(Eigen::Triplet<double>(n + r, it.row(), it.value()));
+                        triplets.emplace_back(Eigen::Triplet<double>(it.row(), n + r, it.value()));
+                    }
+                    triplets.emplace_back(Eigen::Triplet<double>(n + r, n + r, 0));
+                }
+                C_active.setFromTriplets(active_triplets.begin(), active_triplets.end());
+            }
+            Eigen::SparseMatrix<double> K(n + a, n + a);
+            K.setFromTriplets(triplets.begin(), triplets.end());
+
+            // The reduced Hessian of a long trajectory has eigenvalues far below any regularization that keeps
+            // the LDL' factor stable without pivoting, so the exact system is factorized by LU with pivoting
+            // and regularized only if the active rows are dependent
+            Eigen::SparseLU<Eigen::SparseMatrix<double>> kkt(K);
+            if (kkt.info() != Eigen::Success) {
+                for (int j = 0; j < n + a; j++) {
+                    K.coeffRef(j, j) += j < n ? POLISH_DELTA : -POLISH_DELTA;
+                }
+                kkt.compute(K);
+                if (kkt.info() != Eigen::Success) {
+                    return false;
+                }
+            }
+
+            Eigen::VectorXd rhs(n + a);
+            rhs.head(n) = -q;
+            rhs.tail(a) = Eigen::Map<const Eigen::VectorXd>(target.data(), a);
+            Eigen::VectorXd sol = kkt.solve(rhs);
+            for (int iter = 0; iter < POLISH_REFINE; iter++) {
+                Eigen::VectorXd res = rhs;
+                res.head(n) -= P * sol.head(n) + C_active.transpose() * sol.tail(a);
+                res.tail(a) -= C_active * sol.head(n);
+                sol += kkt.solve(res);
+            }
+            if (!sol.allFinite()) {
+                return false;
+            }
+
+            *x_polish = sol.head(n);
+            *y_polish = Eigen::VectorXd::Zero(m);
+            for (int r = 0; r < a; r++) {
+                (*y_polish)(active[r]) = sol(n + r);
+            }
+            return true;
+        }
+
+        bool iterate(const QPProblem &qp, Eigen::VectorXd *x_ptr, double *obj) {
+            // Warm start, the previous dual is reused if the constraints have the same shape
+            Eigen::VectorXd x = x_ptr->size() == n ? Eigen::VectorXd(x_ptr->cwiseQuotient(D))
+                                                   : Eigen::VectorXd::Zero(n);
+            Eigen::VectorXd z = (C * x).cwiseMax(l).cwiseMin(u);
+            Eigen::VectorXd y = y_prev.size() == m ? Eigen::VectorXd(cost_scale * y_prev.cwiseQuotient(E))
+                                                   : Eigen::VectorXd::Zero(m);
+
+            bool converged = false;
+            double prim_res = 0, dual_res = 0, gap = 0;
+            int iter;
+            for (iter = 1; iter <= max_iter; iter++) {
+                Eigen::VectorXd x_tilde = ldlt.solve(SIGMA * x - q + Ct * (rho_vec.cwiseProduct(z) - y));
+                Eigen::VectorXd z_tilde = C * x_tilde;
+                x = ALPHA * x_tilde + (1 - ALPHA) * x;
+                Eigen::VectorXd z_relaxed = ALPHA * z_tilde + (1 - ALPHA) * z;
+                Eigen::VectorXd z_next = (z_relaxed + y.cwiseQuotient(rho_vec)).cwiseMax(l).cwiseMin(u);
+                y += rho_vec.cwiseProduct(z_relaxed - z_next);
+                z = z_next;
+
+                if (iter % CHECK_INTERVAL != 0 && iter != max_iter) {
+                    continue;
+                }
+
+                converged = isOptimal(x, y, &prim_res, &dual_res, &gap);
+
+                // The ADMM iterate is only accurate to eps, the active set it identifies is solved exactly
+                if (converged || iter % POLISH_INTERVAL == 0 || iter == max_iter) {
+                    Eigen::VectorXd x_polish, y_polish;
+                    double prim_polish, dual_polish, gap_polish;
+                    if (polish(z, y, &x_polish, &y_polish) &&
+                        isOptimal(x_polish, y_polish, &prim_polish, &dual_polish, &gap_polish)) {
+                        x = x_polish;
+                        y = y_polish;
+                        prim_res = prim_polish;
+                        dual_res = dual_polish;
+                        gap = gap_polish;
+                        converged = true;
+                        if (log) {
+                            ROS_INFO("QPSolver: ADMM solution polished");
+                        }
+                    }
+                }
+                if (converged) {
+                    break;
+                }
+
+                // Balance the primal and dual residuals of the scaled problem
+                Eigen::VectorXd Cx = C * x;
+                Eigen::VectorXd Px = P * x;
+                Eigen::VectorXd Cty = Ct * y;
+                double prim_ratio = (Cx - z).lpNorm<Eigen::Infinity>() /
+                                    (std::max(Cx.lpNorm<Eigen::Infinity>(), z.lpNorm<Eigen::Infinity>()) + 1e-10);
+                double dual_ratio = (Px + q + Cty).lpNorm<Eigen::Infinity>() /
+                                    (std::max({Px.lpNorm<Eigen::Infinity>(), Cty.lpNorm<Eigen::Infinity>(),
+                                               q.lpNorm<Eigen::Infinity>()}) + 1e-10);
+                double rho_next = std::min(std::max(rho * std::sqrt(prim_ratio / (dual_ratio + 1e-10)), RHO_MIN),
+                                           RHO_MAX);
+                if (rho_next > 5 * rho || rho_next < 0.2 * rho) {
+                    rho = rho_next;
+                    if (!factorize()) {
+                        ROS_ERROR("QPSolver: ADMM factorization failed");
+                        ready = false;
+                        return false;
+                    }
+                }
+            }
+
+            *x_ptr = D.cwiseProduct(x);
+            *obj = x_ptr->dot(qp.Q * (*x_ptr));
+            if (qp.c.size() == n) {
+                *obj += qp.c.dot(*x_ptr);
+            }
+            y_prev = E.cwiseProduct(y) / cost_scale;
+
+            if (log) {
+                ROS_INFO_STREAM("QPSolver: ADMM iter=" << std::min(iter, max_iter) << ", primal residual="
+                                                       << prim_res << ", dual residual=" << dual_res
+                                                       << ", duality gap=" << gap);
+            }
+            if (!converged) {
+                ROS_WARN_STREAM("QPSolver: ADMM did not converge in " << max_iter << " iterations, primal residual="
+                                                                      << prim_res << ", dual residual=" << dual_res
+                                                                      << ", duality gap=" << gap);
+            }
+            return converged;
+        }
+    };
+
+    // The QP backend selected by param.qp_solver, the model is exported to log_path if log.
+    // CPLEX is limited to a single thread if the solver runs concurrently with other solvers.
+    inline std::shared_ptr<QPSolver> createQPSolver(const Param &param, bool log, const std::string &log_path,
+                                                    bool concurrent = false) {
+        if (param.qp_solver == "cplex") {
+#ifdef SWARM_PLANNER_USE_CPLEX
+            return std::make_shared<CplexQPSolver>(log, log ? log_path : "", concurrent ? 1 : 0);
+#else
+            ROS_WARN("QPSolver: built without CPLEX, use ADMM");
+#endif
+        } else if (param.qp_solver != "admm") {
+            ROS_WARN_STREAM("QPSolver: unknown solver " << param.qp_solver << ", use ADMM");
+        }
+        return std::make_shared<ADMMQPSolver>(param.qp_max_iter, param.qp_eps, log);
+    }
+}
@@ -1,82 +1,294 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <atomic>
+#include <map>
+#include <tuple>
 
+#include <distance_field.hpp>
 #include <init_traj_planner.hpp>
 #include <mission.hpp>
+#include <obstacle_grid.hpp>
+#include <parallel.hpp>
 #include <param.hpp>
 #include <timer.hpp>
 
 namespace SwarmPlanning {
     class Corridor {
     public:
-        Corridor(std::shared_ptr<DynamicEDTOctomap> _distmap_obj,
+        // If octree_obj is given, the box corridor is checked against the obstacles inflated from its occupied
+        // leaves, one grid per distinct quad_size. Continuous map updates always use the distance field.
+        Corridor(std::shared_ptr<DistanceField> _distmap_obj,
                  Mission _mission,
-                 Param _param)
+                 Param _param,
+                 const std::shared_ptr<octomap::OcTree> &octree_obj = nullptr)
                 : distmap_obj(std::move(_distmap_obj)),
                   mission(std::move(_mission)),
                   param(std::move(_param)) {
+            if (octree_obj && !param.map_continuous && !param.polytope) {
+                for (int qi = 0; qi < mission.qn; qi++) {
+                    double margin = mission.quad_size[qi];
+                    if (obstacle_grids.find(margin) == obstacle_grids.end()) {
+                        obstacle_grids[margin] = std::make_shared<ObstacleGrid>(
+                                *octree_obj, margin - SP_EPSILON_FLOAT,
+                                octomap::point3d(param.world_x_min, param.world_y_min, param.world_z_min),
+                                octomap::point3d(param.world_x_max, param.world_y_max, param.world_z_max),
+                                param.num_threads);
+                    }
+                }
+            }
         }
 
         bool update(bool _log, SwarmPlanning::PlanResult* _planResult_ptr) {
             log = _log;
             planResult_ptr = _planResult_ptr;
             makespan = planResult_ptr->T.back();
-            return updateObsBox() && updateRelBox();
+            if (!((param.polytope ? updatePolyObsBox() : updateObsBox()) && updateRelPair() && updateRelBox() &&
+                  updateRedundantRSFC())) {
+                return false;
+            }
+            saveCache();
+            return true;
+        }
+
+        // Incremental update after the map is changed in changed_region and the initial trajectories are replanned
+        // from the current states. The remaining horizon is shorter than the cached one, so the cache is shifted by
+        // the number of segments that matches the grid paths of the most agents. Only the SFC of the agents whose
+        // grid path differs or whose shifted SFC meets changed_region, and the RSFC of the pairs involving them,
+        // are rebuilt. All corridors are rebuilt if no shift matches.
+        bool update(bool _log, SwarmPlanning::PlanResult* _planResult_ptr, const std::vector<double> &changed_region) {
+            int shift = cache_SFC.size() == mission.qn ? findCacheShift(*_planResult_ptr) : -1;
+            if (shift < 0) {
+                if (_log) {
+                    ROS_INFO("Corridor: no cached corridor matches the initial trajectory, rebuild all corridors");
+                }
+                return update(_log, _planResult_ptr);
+            }
+            shiftCache(shift, _planResult_ptr->T);
+
+            log = _log;
+            planResult_ptr = _planResult_ptr;
+            makespan = planResult_ptr->T.back();
+
+            // SFC
+            Timer timer;
+            planResult_ptr->SFC = cache_SFC;
+            planResult_ptr->SFC_poly = cache_SFC_poly;
+            std::vector<bool> changed(mission.qn, false);
+            int count_changed = 0;
+            for (int qi = 0; qi < mission.qn; qi++) {
+                changed[qi] = !isPathCached(qi, shift) || isSFCInRegion(qi, changed_region);
+                if (!changed[qi]) {
+                    continue;
+                }
+                count_changed++;
+                planResult_ptr->SFC[qi].clear();
+                if (param.polytope) {
+                    planResult_ptr->SFC_poly[qi].clear();
+                }
+                if (!(param.polytope ? updatePolyObsBox(qi) : updateObsBox(qi))) {
+                    return false;
+                }
+            }
+            timer.stop();
+            ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds() << ", shift=" << shift
+                                                     << ", changed agents=" << count_changed);
+
+            // RSFC
+            if (!updateRelPair()) {
+                return false;
+            }
+            timer.reset();
+            if (!buildRSFC(false, changed)) {
+                return false;
+            }
+            timer.stop();
+            ROS_INFO_STREAM("Corridor: RSFC runtime=" << timer.elapsedSeconds());
+            if (!updateRedundantRSFC()) {
+                return false;
+            }
+
+            saveCache();
+            return true;
         }
 
         bool update_flat_box(bool _log, SwarmPlanning::PlanResult* _planResult_ptr) {
             log = _log;
             planResult_ptr = _planResult_ptr;
             makespan = planResult_ptr->T.size() - 1;
-            return updateFlatObsBox() && updateFlatRelBox() && updateTs();
+            return updateFlatObsBox() && updateRelPair() && updateFlatRelBox() && updateTs() && updateRedundantRSFC();
         }
 
     private:
-        std::shared_ptr<DynamicEDTOctomap> distmap_obj;
+        std::shared_ptr<DistanceField> distmap_obj;
+        std::map<double, std::shared_ptr<ObstacleGrid>> obstacle_grids; // inflated by quad_size
         Mission mission;
         Param param;
 
         bool log;
         SwarmPlanning::PlanResult* planResult_ptr;
         double makespan;
+        std::vector<std::pair<int, int>> rel_pairs; // agent pairs (qi < qj) that need RSFC
+
+        // Corridors of the last update for incremental update, kept before time scaling of RBPPlanner
+        std::vector<double> cache_T;
+        initTraj_t cache_initTraj;
+        SFC_t cache_SFC;
+        SFC_poly_t cache_SFC_poly;
+        RSFC_t cache_RSFC;
+
+        void saveCache() {
+            cache_T = planResult_ptr->T;
+            cache_initTraj = planResult_ptr->initTraj;
+            cache_SFC = planResult_ptr->SFC;
+            cache_SFC_poly = planResult_ptr->SFC_poly;
+            cache_RSFC = planResult_ptr->RSFC;
+        }
 
-        bool isObstacleInBox(const std::vector<double> &box, double margin) {
-            double x, y, z;
-            int count1 = 0;
-            for (double i = box[0]; i < box[3] + SP_EPSILON_FLOAT; i += param.box_xy_res) {
-                int count2 = 0;
-                for (double j = box[1]; j < box[4] + SP_EPSILON_FLOAT; j += param.box_xy_res) {
-                    int count3 = 0;
-                    for (double k = box[2]; k < box[5] + SP_EPSILON_FLOAT; k += param.box_z_res) {
-                        x = i + SP_EPSILON_FLOAT;
-                        if (count1 == 0 && box[0] > param.world_x_min + SP_EPSILON_FLOAT) {
-                            x = box[0] - SP_EPSILON_FLOAT;
-                        }
-                        y = j + SP_EPSILON_FLOAT;
-                        if (count2 == 0 && box[1] > param.world_y_min + SP_EPSILON_FLOAT) {
-                            y = box[1] - SP_EPSILON_FLOAT;
-                        }
-                        z = k + SP_EPSILON_FLOAT;
-                        if (count3 == 0 && box[2] > param.world_z_min + SP_EPSILON_FLOAT) {
-                            z = box[2] - SP_EPSILON_FLOAT;
-                        }
+        // Whether the grid path of qi in planResult is the cached one from segment shift.
+        // initTraj[qi][0] is the current state, which is not on the grid and is checked by isPathCached.
+        bool isGridPathCached(const SwarmPlanning::PlanResult &planResult, int qi, int shift) const {
+            const auto &path = planResult.initTraj[qi];
+            const auto &cache_path = cache_initTraj[qi];
+            for (int i = 1; i < path.size(); i++) {
+                if (i + shift >= cache_path.size() || !(path[i] == cache_path[i + shift])) {
+                    return false;
+                }
+            }
+            return true;
+        }
 
-                        octomap::point3d cur_point(x, y, z);
-                        float dist = distmap_obj.get()->getDistance(cur_point);
-                        if (dist < margin - SP_EPSILON_FLOAT) {
-                            return true;
-                        }
-                        count3++;
-                    }
-                    count2++;
+        // Segment shift of the cache that matches the grid paths of the most agents, -1 if there is none
+        // or the segment time of planResult is not the cached one from the shift
+        int findCacheShift(const SwarmPlanning::PlanResult &planResult) const {
+            int M_cache = cache_T.size() - 1;
+            int M = planResult.T.size() - 1;
+            int best_shift = -1, best_count = 0;
+            for (int shift = 0; shift <= M_cache - M; shift++) {
+                bool aligned = true;
+                for (int m = 0; m <= M; m++) {
+                    aligned &= fabs(planResult.T[m] - planResult.T[0] - cache_T[m + shift] + cache_T[shift])
+                               < SP_EPSILON_FLOAT;
                 }
-                count1++;
+                if (!aligned) {
+                    continue;
+                }
+                int count = 0;
+                for (int qi = 0; qi < mission.qn; qi++) {
+                    count += isGridPathCached(planResult, qi, shift);
+                }
+                if (count > best_count) {
+                    best_shift = shift;
+                    best_count = count;
+                }
+            }
+            return best_shift;
+        }
+
+        // Move the corridors, whose end times are cached segment times, to the segment time T, which is the cached one
+        // from segment shift. The corridors before the shift are dropped and the ones after the end of T are clipped.
+        template <typename Corridor>
+        void shiftCorridors(int shift, const std::vector<double> &T, std::vector<Corridor> *corridors) const {
+            int M = T.size() - 1;
+            std::vector<Corridor> shifted;
+            for (const auto &corridor : *corridors) {
+                int m = std::lower_bound(cache_T.begin(), cache_T.end(), corridor.second - SP_EPSILON_FLOAT)
+                        - cache_T.begin() - shift;
+                if (m > 0) {
+                    shifted.emplace_back(std::make_pair(corridor.first, T[std::min(m, M)]));
+                }
+                if (m >= M) {
+                    break;
+                }
+            }
+            *corridors = std::move(shifted);
+        }
+
+        // Move the cache to the segment time T, which is the cached one from segment shift
+        void shiftCache(int shift, const std::vector<double> &T) {
+            for (int qi = 0; qi < mission.qn; qi++) {
+                shiftCorridors(shift, T, &cache_SFC[qi]);
+                if (!cache_SFC_poly.empty()) {
+                    shiftCorridors(shift, T, &cache_SFC_poly[qi]);
+                }
+            }
+
+            RSFC_t RSFC_shifted;
+            std::vector<std::pair<octomap::point3d, double>> rsfc_pair;
+            for (int p = 0; p < cache_RSFC.size(); p++) {
+                rsfc_pair.clear();
+                for (int ri = cache_RSFC.offset[p]; ri < cache_RSFC.offset[p + 1]; ri++) {
+                    rsfc_pair.emplace_back(std::make_pair(cache_RSFC.normal[ri], cache_RSFC.time[ri]));
+                }
+                shiftCorridors(shift, T, &rsfc_pair);
+                RSFC_shifted.addPair(cache_RSFC.pairs[p].first, cache_RSFC.pairs[p].second, rsfc_pair);
             }
+            cache_RSFC = std::move(RSFC_shifted);
+            cache_T = T;
+        }
 
+        // Whether the shifted cache is the SFC of qi in planResult_ptr, after shiftCache(shift).
+        // The grid path must be the cached one, and the first SFC must contain the current state.
+        bool isPathCached(int qi, int shift) {
+            if (!isGridPathCached(*planResult_ptr, qi, shift)) {
+                return false;
+            }
+            const octomap::point3d &start = planResult_ptr->initTraj[qi][0];
+            if (param.polytope) {
+                return isPointInPolytope(start, planResult_ptr->SFC_poly[qi].front().first);
+            }
+            return isPointInBox(start, planResult_ptr->SFC[qi].front().first);
+        }
+
+        // Whether the SFC of qi can be affected by the obstacles in region
+        bool isSFCInRegion(int qi, const std::vector<double> &region) {
+            for (const auto &sfc : planResult_ptr->SFC[qi]) {
+                // SFC is in configuration space, obstacles within quad_size from the box affect it
+                bool affected = true;
+                for (int k = 0; k < 3; k++) {
+                    if (region[k] > sfc.first[k + 3] + mission.quad_size[qi] ||
+                        sfc.first[k] > region[k + 3] + mission.quad_size[qi]) {
+                        affected = false;
+                    }
+                }
+                if (affected) {
+                    return true;
+                }
+            }
             return false;
         }
 
+        // Sample points of [lower, upper] on the lattice of the given resolution,
+        // the first point is pulled outside of the box unless it is on the world boundary
+        void getBoxLattice(double lower, double upper, double res, double world_min, std::vector<double> *coords) {
+            int count = (int) floor((upper - lower) / res + SP_EPSILON_FLOAT) + 1;
+            coords->resize(count);
+            for (int c = 0; c < count; c++) {
+                (*coords)[c] = lower + c * res + SP_EPSILON_FLOAT;
+            }
+            if (lower > world_min + SP_EPSILON_FLOAT) {
+                (*coords)[0] = lower - SP_EPSILON_FLOAT;
+            }
+        }
+
+        bool isObstacleInBox(const std::vector<double> &box, double margin) {
+            std::vector<double> xs, ys, zs;
+            getBoxLattice(box[0], box[3], param.box_xy_res, param.world_x_min, &xs);
+            getBoxLattice(box[1], box[4], param.box_xy_res, param.world_y_min, &ys);
+            getBoxLattice(box[2], box[5], param.box_z_res, param.world_z_min, &zs);
+
+            // Every cell between the first and the last sample is checked
+            auto grid = obstacle_grids.find(margin);
+            if (grid != obstacle_grids.end()) {
+                int key_lo[3] = {grid->second->getKey(xs.front()), grid->second->getKey(ys.front()),
+                                 grid->second->getKey(zs.front())};
+                int key_hi[3] = {grid->second->getKey(xs.back()), grid->second->getKey(ys.back()),
+                                 grid->second->getKey(zs.back())};
+                return grid->second->isOccupied(key_lo, key_hi);
+            }
+            return distmap_obj->isAnyBelow(xs, ys, zs, margin - SP_EPSILON_FLOAT);
+        }
+
         bool isBoxInBoundary(const std::vector<double> &box) {
             return box[0] > param.world_x_min - SP_EPSILON &&
                    box[1] > param.world_y_min - SP_EPSILON &&
@@ -150,97 +362,280 @@ namespace SwarmPlanning {
         }
 
         bool updateObsBox() {
-            double x_next, y_next, z_next, dx, dy, dz;
             Timer timer;
 
             planResult_ptr->SFC.resize(mission.qn);
             for (size_t qi = 0; qi < mission.qn; ++qi) {
-                std::vector<double> box_prev{0, 0, 0, 0, 0, 0};
+                if (!updateObsBox(qi)) {
+                    return false;
+                }
+            }
 
-                for (int i = 0; i < planResult_ptr->initTraj[qi].size() - 1; i++) {
-                    auto state = planResult_ptr->initTraj[qi][i];
-                    double x = state.x();
-                    double y = state.y();
-                    double z = state.z();
+            timer.stop();
+            ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds());
+            return true;
+        }
 
-                    std::vector<double> box;
-                    auto state_next = planResult_ptr->initTraj[qi][i + 1];
-                    x_next = state_next.x();
-                    y_next = state_next.y();
-                    z_next = state_next.z();
+        bool updateObsBox(size_t qi) {
+            double x_next, y_next, z_next, dx, dy, dz;
+            std::vector<double> box_prev{0, 0, 0, 0, 0, 0};
+
+            for (int i = 0; i < planResult_ptr->initTraj[qi].size() - 1; i++) {
+                auto state = planResult_ptr->initTraj[qi][i];
+                double x = state.x();
+                double y = state.y();
+                double z = state.z();
+
+                std::vector<double> box;
+                auto state_next = planResult_ptr->initTraj[qi][i + 1];
+                x_next = state_next.x();
+                y_next = state_next.y();
+                z_next = state_next.z();
+
+                if (isPointInBox(octomap::point3d(x_next, y_next, z_next), box_prev)) {
+                    continue;
+                }
 
-                    if (isPointInBox(octomap::point3d(x_next, y_next, z_next), box_prev)) {
-                        continue;
-                    }
+                // Initialize box
+                box.emplace_back(round(std::min(x, x_next) / param.box_xy_res) * param.box_xy_res);
+                box.emplace_back(round(std::min(y, y_next) / param.box_xy_res) * param.box_xy_res);
+                box.emplace_back(round(std::min(z, z_next) / param.box_z_res) * param.box_z_res);
+                box.emplace_back(round(std::max(x, x_next) / param.box_xy_res) * param.box_xy_res);
+                box.emplace_back(round(std::max(y, y_next) / param.box_xy_res) * param.box_xy_res);
+                box.emplace_back(round(std::max(z, z_next) / param.box_z_res) * param.box_z_res);
 
-                    // Initialize box
-                    box.emplace_back(round(std::min(x, x_next) / param.box_xy_res) * param.box_xy_res);
-                    box.emplace_back(round(std::min(y, y_next) / param.box_xy_res) * param.box_xy_res);
-                    box.emplace_back(round(std::min(z, z_next) / param.box_z_res) * param.box_z_res);
-                    box.emplace_back(round(std::max(x, x_next) / param.box_xy_res) * param.box_xy_res);
-                    box.emplace_back(round(std::max(y, y_next) / param.box_xy_res) * param.box_xy_res);
-                    box.emplace_back(round(std::max(z, z_next) / param.box_z_res) * param.box_z_res);
+                if (isObstacleInBox(box, mission.quad_size[qi])) {
+                    ROS_ERROR("Corridor: Invalid initial trajectory. Obstacle invades initial trajectory.");
+                    ROS_ERROR_STREAM("Corridor: x " << x << ", y " << y << ", z " << z);
 
-                    if (isObstacleInBox(box, mission.quad_size[qi])) {
-                        ROS_ERROR("Corridor: Invalid initial trajectory. Obstacle invades initial trajectory.");
-                        ROS_ERROR_STREAM("Corridor: x " << x << ", y " << y << ", z " << z);
+                    bool debug =isObstacleInBox(box, mission.quad_size[qi]);
+                    return false;
+                }
+                expand_box(box, mission.quad_size[qi]);
 
-                        bool debug =isObstacleInBox(box, mission.quad_size[qi]);
-                        return false;
-                    }
-                    expand_box(box, mission.quad_size[qi]);
+                planResult_ptr->SFC[qi].emplace_back(std::make_pair(box, -1));
 
-                    planResult_ptr->SFC[qi].emplace_back(std::make_pair(box, -1));
+                box_prev = box;
+            }
 
-                    box_prev = box;
+            // Generate box time segment
+            updateBoxTime(qi);
+            return true;
+        }
+
+        bool isPointInPolytope(const octomap::point3d &point, const polytope_t &polytope) {
+            for (const auto &halfspace : polytope) {
+                if (halfspace.first.dot(point) > halfspace.second + SP_EPSILON_FLOAT) {
+                    return false;
                 }
+            }
+            return true;
+        }
 
-                // Generate box time segment
-                int box_max = planResult_ptr->SFC[qi].size();
-                int path_max = planResult_ptr->initTraj[qi].size();
-                Eigen::MatrixXd box_log = Eigen::MatrixXd::Zero(box_max, path_max);
-
-                for (int i = 0; i < box_max; i++) {
-                    for (int j = 0; j < path_max; j++) {
-                        if (isPointInBox(planResult_ptr->initTraj[qi][j], planResult_ptr->SFC[qi][i].first)) {
-                            if (j == 0) {
-                                box_log(i, j) = 1;
-                            } else {
-                                box_log(i, j) = box_log(i, j - 1) + 1;
-                            }
+        // Sample the closest obstacles of the grid points in the bound
+        void getObstaclePoints(const std::vector<double> &bound, std::vector<Eigen::Vector3d> *obs_points) {
+            float max_dist = distmap_obj.get()->getMaxDist();
+            int nx = (int) floor((bound[3] - bound[0]) / param.box_xy_res + SP_EPSILON_FLOAT) + 1;
+            int ny = (int) floor((bound[4] - bound[1]) / param.box_xy_res + SP_EPSILON_FLOAT) + 1;
+            int nz = (int) floor((bound[5] - bound[2]) / param.box_z_res + SP_EPSILON_FLOAT) + 1;
+            for (int i = 0; i < nx; i++) {
+                for (int j = 0; j < ny; j++) {
+                    for (int k = 0; k < nz; k++) {
+                        octomap::point3d point(bound[0] + i * param.box_xy_res,
+                                               bound[1] + j * param.box_xy_res,
+                                               bound[2] + k * param.box_z_res);
+                        float dist;
+                        octomap::point3d obs;
+                        distmap_obj.get()->getDistanceAndClosestObstacle(point, dist, obs);
+                        if (dist < 0 || dist >= max_dist) {
+                            continue;
                         }
+                        obs_points->emplace_back(Eigen::Vector3d(obs.x(), obs.y(), obs.z()));
+                    }
+                }
+            }
+
+            auto less = [](const Eigen::Vector3d &a, const Eigen::Vector3d &b) {
+                return std::tie(a(0), a(1), a(2)) < std::tie(b(0), b(1), b(2));
+            };
+            std::sort(obs_points->begin(), obs_points->end(), less);
+            obs_points->erase(std::unique(obs_points->begin(), obs_points->end()), obs_points->end());
+        }
+
+        // Build a convex polytope in configuration space that contains the line segment p1-p2.
+        // An ellipsoid aligned with the segment is inflated until it touches the obstacles (inflated by r),
+        // then the obstacle points are cut off by the tangent planes of the ellipsoid, nearest ones first.
+        bool buildPolytope(const octomap::point3d &p1, const octomap::point3d &p2, double r,
+                           polytope_t *polytope, std::vector<double> *box) {
+            Eigen::Vector3d v1(p1.x(), p1.y(), p1.z());
+            Eigen::Vector3d v2(p2.x(), p2.y(), p2.z());
+
+            std::vector<double> bound{
+                    std::max(std::min(v1(0), v2(0)) - param.polytope_range, param.world_x_min),
+                    std::max(std::min(v1(1), v2(1)) - param.polytope_range, param.world_y_min),
+                    std::max(std::min(v1(2), v2(2)) - param.polytope_range, param.world_z_min),
+                    std::min(std::max(v1(0), v2(0)) + param.polytope_range, param.world_x_max),
+                    std::min(std::max(v1(1), v2(1)) + param.polytope_range, param.world_y_max),
+                    std::min(std::max(v1(2), v2(2)) + param.polytope_range, param.world_z_max)};
+
+            // Obstacles within r from the bound can also invade the polytope
+            std::vector<double> search_bound = bound;
+            for (int i = 0; i < 3; i++) {
+                search_bound[i] -= r;
+                search_bound[i + 3] += r;
+            }
+            std::vector<Eigen::Vector3d> obs_points;
+            getObstaclePoints(search_bound, &obs_points);
+
+            // Seed ellipsoid, the major axis is the segment
+            Eigen::Vector3d c = (v1 + v2) / 2;
+            double a = std::max((v2 - v1).norm() / 2, SP_EPSILON_FLOAT);
+            Eigen::Vector3d e1 = Eigen::Vector3d::UnitX();
+            if ((v2 - v1).norm() > SP_EPSILON_FLOAT) {
+                e1 = (v2 - v1).normalized();
+            }
+            Eigen::Vector3d e2 = e1.unitOrthogonal();
+            Eigen::Matrix3d R;
+            R << e1, e2, e1.cross(e2);
+
+            // Inflate minor axes
+            double b = a;
+            for (const auto &q : obs_points) {
+                Eigen::Vector3d u = R.transpose() * (q - c);
+                double s = 1 - u(0) * u(0) / (a * a);
+                if (s > SP_EPSILON) {
+                    double rho = std::max(u.tail<2>().norm() - r, 0.0);
+                    b = std::min(b, rho / sqrt(s));
+                }
+            }
+            b = std::max(b, SP_EPSILON_FLOAT);
+            Eigen::Matrix3d A = R * Eigen::Vector3d(1 / (a * a), 1 / (b * b), 1 / (b * b)).asDiagonal() * R.transpose();
+
+            // Separating half-spaces
+            polytope->clear();
+            while (!obs_points.empty()) {
+                auto q = *std::min_element(obs_points.begin(), obs_points.end(),
+                                           [&](const Eigen::Vector3d &q1, const Eigen::Vector3d &q2) {
+                                               return (q1 - c).dot(A * (q1 - c)) < (q2 - c).dot(A * (q2 - c));
+                                           });
+                Eigen::Vector3d normal = A * (q - c);
+                double offset = 0;
+                if (normal.norm() > SP_EPSILON_FLOAT) {
+                    normal.normalize();
+                    offset = normal.dot(q) - r;
+                }
+                if (normal.norm() <= SP_EPSILON_FLOAT ||
+                    normal.dot(v1) > offset + SP_EPSILON_FLOAT || normal.dot(v2) > offset + SP_EPSILON_FLOAT) {
+                    // The tangent plane cuts the segment, use the plane facing the closest point of the segment
+                    double t = std::min(std::max((q - v1).dot(e1), 0.0), (v2 - v1).norm());
+                    normal = q - (v1 + t * e1);
+                    if (normal.norm() < r + SP_EPSILON_FLOAT) {
+                        return false;
                     }
+                    normal.normalize();
+                    offset = normal.dot(q) - r;
                 }
+                polytope->emplace_back(std::make_pair(octomap::point3d(normal(0), normal(1), normal(2)), offset));
 
-                int box_iter = 0;
-                for (int path_iter = 0; path_iter < path_max; path_iter++) {
-                    if (box_iter == box_max - 1) {
-                        if (box_log(box_iter, path_iter) > 0) {
+                obs_points.erase(std::remove_if(obs_points.begin(), obs_points.end(),
+                                                [&](const Eigen::Vector3d &q1) {
+                                                    return normal.dot(q1) - r > offset - SP_EPSILON_FLOAT;
+                                                }),
+                                 obs_points.end());
+            }
+            for (int i = 0; i < 3; i++) {
+                octomap::point3d normal(0, 0, 0);
+                normal(i) = 1;
+                polytope->emplace_back(std::make_pair(normal, bound[i + 3]));
+                polytope->emplace_back(std::make_pair(-normal, -bound[i]));
+            }
+
+            // Bounding box from the vertices of the polytope
+            *box = {SP_INFINITY, SP_INFINITY, SP_INFINITY, -SP_INFINITY, -SP_INFINITY, -SP_INFINITY};
+            int size = polytope->size();
+            for (int i = 0; i < size; i++) {
+                for (int j = i + 1; j < size; j++) {
+                    for (int k = j + 1; k < size; k++) {
+                        Eigen::Matrix3d H;
+                        Eigen::Vector3d h;
+                        int idx[3] = {i, j, k};
+                        for (int l = 0; l < 3; l++) {
+                            const auto &halfspace = (*polytope)[idx[l]];
+                            H.row(l) << halfspace.first.x(), halfspace.first.y(), halfspace.first.z();
+                            h(l) = halfspace.second;
+                        }
+                        if (std::abs(H.determinant()) < SP_EPSILON_FLOAT) {
                             continue;
-                        } else {
-                            box_iter--;
                         }
-                    }
-                    if (box_log(box_iter, path_iter) > 0 && box_log(box_iter + 1, path_iter) > 0) {
-                        int count = 1;
-                        while (path_iter + count < path_max && box_log(box_iter, path_iter + count) > 0
-                               && box_log(box_iter + 1, path_iter + count) > 0) {
-                            count++;
+                        Eigen::Vector3d vertex = H.partialPivLu().solve(h);
+                        octomap::point3d point(vertex(0), vertex(1), vertex(2));
+                        if (!isPointInPolytope(point, *polytope)) {
+                            continue;
+                        }
+                        for (int l = 0; l < 3; l++) {
+                            (*box)[l] = std::min((*box)[l], vertex(l));
+                            (*box)[l + 3] = std::max((*box)[l + 3], vertex(l));
                         }
-                        int obs_index = path_iter + count / 2;
-                        planResult_ptr->SFC[qi][box_iter].second = planResult_ptr->T[obs_index];
-
-                        path_iter = path_iter + count / 2;
-                        box_iter++;
-                    } else if (box_log(box_iter, path_iter) == 0) {
-                        box_iter--;
-                        path_iter--;
                     }
                 }
-                planResult_ptr->SFC[qi][box_max - 1].second = makespan;
+            }
+            return (*box)[0] <= (*box)[3];
+        }
+
+        bool updatePolyObsBox(int qi) {
+            for (int iter = 1; iter < planResult_ptr->T.size(); iter++) {
+                const octomap::point3d &p1 = planResult_ptr->initTraj[qi][iter - 1];
+                const octomap::point3d &p2 = planResult_ptr->initTraj[qi][iter];
+
+                // Reuse the previous polytope if it contains the segment
+                if (!planResult_ptr->SFC_poly[qi].empty() &&
+                    isPointInPolytope(p1, planResult_ptr->SFC_poly[qi].back().first) &&
+                    isPointInPolytope(p2, planResult_ptr->SFC_poly[qi].back().first)) {
+                    planResult_ptr->SFC_poly[qi].back().second = planResult_ptr->T[iter];
+                    planResult_ptr->SFC[qi].back().second = planResult_ptr->T[iter];
+                    continue;
+                }
+
+                polytope_t polytope;
+                std::vector<double> box;
+                if (!buildPolytope(p1, p2, mission.quad_size[qi], &polytope, &box)) {
+                    ROS_ERROR("Corridor: Invalid initial trajectory. Obstacle invades initial trajectory.");
+                    ROS_ERROR_STREAM("Corridor: x " << p1.x() << ", y " << p1.y() << ", z " << p1.z());
+                    return false;
+                }
+                planResult_ptr->SFC_poly[qi].emplace_back(std::make_pair(polytope, planResult_ptr->T[iter]));
+                planResult_ptr->SFC[qi].emplace_back(std::make_pair(box, planResult_ptr->T[iter]));
+            }
+            return true;
+        }
+
+        // Convex polytope SFC, SFC keeps their bounding boxes for the broad phase and visualization
+        bool updatePolyObsBox() {
+            Timer timer;
+
+            planResult_ptr->SFC.assign(mission.qn, {});
+            planResult_ptr->SFC_poly.assign(mission.qn, {});
+            std::atomic<bool> success(true);
+            parallel_for(mission.qn, param.num_threads, [&](int qi, int tid) {
+                if (success && !updatePolyObsBox(qi)) {
+                    success = false;
+                }
+            });
+            if (!success) {
+                return false;
             }
 
             timer.stop();
+            if (log) {
+                int count_poly = 0, count_halfspace = 0;
+                for (int qi = 0; qi < mission.qn; qi++) {
+                    count_poly += planResult_ptr->SFC_poly[qi].size();
+                    for (const auto &polytope : planResult_ptr->SFC_poly[qi]) {
+                        count_halfspace += polytope.first.size();
+                    }
+                }
+                ROS_INFO_STREAM("Corridor: polytopes=" << count_poly << ", half-spaces=" << count_halfspace);
+            }
             ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds());
             return true;
         }
@@ -289,114 +684,309 @@ namespace SwarmPlanning {
                 }
 
                 // Generate box time segment
-                int box_max = planResult_ptr->SFC[qi].size();
-                int path_max = planResult_ptr->initTraj[qi].size();
-                Eigen::MatrixXd box_log = Eigen::MatrixXd::Zero(box_max, path_max);
-
-                for (int i = 0; i < box_max; i++) {
-                    for (int j = 0; j < path_max; j++) {
-                        if (isPointInBox(planResult_ptr->initTraj[qi][j], planResult_ptr->SFC[qi][i].first)) {
-                            if (j == 0) {
-                                box_log(i, j) = 1;
-                            } else {
-                                box_log(i, j) = box_log(i, j - 1) + 1;
-                            }
-                        }
+                updateBoxTime(qi);
+            }
+
+            timer.stop();
+            ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds());
+            return true;
+        }
+
+        bool isPathInBox(int qi, int path_iter, int box_iter) {
+            return isPointInBox(planResult_ptr->initTraj[qi][path_iter], planResult_ptr->SFC[qi][box_iter].first);
+        }
+
+        // Sweep the initial trajectory and the box sequence together (two pointers: path_iter, box_iter).
+        // The switching time of box_iter is the middle of the path interval shared by box_iter and box_iter + 1.
+        void updateBoxTime(int qi) {
+            int box_max = planResult_ptr->SFC[qi].size();
+            int path_max = planResult_ptr->initTraj[qi].size();
+
+            int box_iter = 0;
+            for (int path_iter = 0; path_iter < path_max; path_iter++) {
+                if (box_iter == box_max - 1) {
+                    if (isPathInBox(qi, path_iter, box_iter) || box_iter == 0) {
+                        continue;
+                    } else {
+                        box_iter--;
+                    }
+                }
+                if (isPathInBox(qi, path_iter, box_iter) && isPathInBox(qi, path_iter, box_iter + 1)) {
+                    int count = 1;
+                    while (path_iter + count < path_max && isPathInBox(qi, path_iter + count, box_iter)
+                           && isPathInBox(qi, path_iter + count, box_iter + 1)) {
+                        count++;
                     }
+                    int obs_index = path_iter + count / 2;
+                    planResult_ptr->SFC[qi][box_iter].second = planResult_ptr->T[obs_index];
+
+                    path_iter = path_iter + count / 2;
+                    box_iter++;
+                } else if (box_iter > 0 && !isPathInBox(qi, path_iter, box_iter)) {
+                    box_iter--;
+                    path_iter--;
                 }
+            }
+            planResult_ptr->SFC[qi][box_max - 1].second = makespan;
+        }
 
-                int box_iter = 0;
-                for (int path_iter = 0; path_iter < path_max; path_iter++) {
-                    if (box_iter == box_max - 1) {
-                        if (box_log(box_iter, path_iter) > 0) {
-                            continue;
-                        } else {
-                            box_iter--;
-                        }
+        void updateFlatBoxTime(int qi) {
+            int box_max = planResult_ptr->SFC[qi].size();
+            int path_max = planResult_ptr->initTraj[qi].size();
+
+            int box_iter = 0;
+            // 循环遍历所有的轨迹点
+            for (int path_iter = 0; path_iter < path_max; path_iter++) {
+                // 如果达到最后一个盒子, 终止循环
+                if (box_iter >= box_max - 1) {
+                    break;
+                }
+                // 检查当前盒子和下一个盒子是否都包含当前的轨迹点 path_iter
+                if (isPathInBox(qi, path_iter, box_iter) && isPathInBox(qi, path_iter, box_iter + 1)) {
+                    int count = 1;
+                    while (path_iter + count < path_max && isPathInBox(qi, path_iter + count, box_iter)
+                           && isPathInBox(qi, path_iter + count, box_iter + 1)) {
+                        count++;
+                    }
+                    double obs_index = path_iter + count / 2;
+                    // 为每个盒子的中心点分配时间戳
+                    planResult_ptr->SFC[qi][box_iter].second = obs_index * param.time_step;
+                    planResult_ptr->T.emplace_back(obs_index);
+                    if (log) {
+                        ROS_INFO_STREAM("Corridor: agent " << qi << " switches box " << box_iter
+                                        << " at path index " << obs_index);
                     }
-                    if (box_log(box_iter, path_iter) > 0 && box_log(box_iter + 1, path_iter) > 0) {
-                        int count = 1;
-                        while (path_iter + count < path_max && box_log(box_iter, path_iter + count) > 0
-                               && box_log(box_iter + 1, path_iter + count) > 0) {
-                            count++;
-                        }
-                        int obs_index = path_iter + count / 2;
-                        planResult_ptr->SFC[qi][box_iter].second = planResult_ptr->T[obs_index];
 
-                        path_iter = path_iter + count / 2;
-                        box_iter++;
-                    } else if (box_log(box_iter, path_iter) == 0) {
-                        box_iter--;
-                        path_iter--;
+                    path_iter = path_iter + count / 2;
+                    box_iter++;
+                }
+            }
+            // 确保最后一个盒子的时间戳设置为整个路径规划的总时间长度, 这样可以保证路径规划在预定的时间内完成.
+            planResult_ptr->SFC[qi][box_max - 1].second = makespan * param.time_step;
+        }
+
+        // Boxes are separated if the gap between them along some axis is larger than collision distance r
+        // (r * downwash along z-axis)
+        bool isBoxSeparated(const std::vector<double> &box1, const std::vector<double> &box2, double r) {
+            for (int k = 0; k < 3; k++) {
+                double margin = (k == 2) ? r * param.downwash : r;
+                if (box2[k] - box1[k + 3] > margin - SP_EPSILON || box1[k] - box2[k + 3] > margin - SP_EPSILON) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Check whether the SFCs of qi and qj are closer than the collision distance at the same time.
+        // SFC[qi][bi] is active in [SFC[qi][bi-1].second, SFC[qi][bi].second]
+        bool isRelPairInteracting(int qi, int qj) {
+            const auto &SFC_i = planResult_ptr->SFC[qi];
+            const auto &SFC_j = planResult_ptr->SFC[qj];
+            double r = mission.quad_size[qi] + mission.quad_size[qj];
+
+            int bi = 0, bj = 0;
+            while (bi < SFC_i.size() && bj < SFC_j.size()) {
+                if (!isBoxSeparated(SFC_i[bi].first, SFC_j[bj].first, r)) {
+                    return true;
+                }
+
+                // advance the box that expires first, boxes share their switching time
+                double ti = SFC_i[bi].second;
+                double tj = SFC_j[bj].second;
+                if (ti < tj - SP_EPSILON) {
+                    bi++;
+                } else if (tj < ti - SP_EPSILON) {
+                    bj++;
+                } else {
+                    if (bi + 1 < SFC_i.size() && !isBoxSeparated(SFC_i[bi + 1].first, SFC_j[bj].first, r)) {
+                        return true;
+                    }
+                    if (bj + 1 < SFC_j.size() && !isBoxSeparated(SFC_i[bi].first, SFC_j[bj + 1].first, r)) {
+                        return true;
+                    }
+                    bi++;
+                    bj++;
+                }
+            }
+            return false;
+        }
+
+        // Broad phase of RSFC generation, find agent pairs that can collide with each other.
+        // Sweep and prune along x-axis over the bounding box of each agent's SFC,
+        // then compare the boxes of candidate pairs in overlapping time intervals.
+        bool updateRelPair() {
+            Timer timer;
+
+            // Bounding box of SFC, inflated by the collision model of the agent
+            std::vector<std::vector<double>> bbox(mission.qn);
+            for (int qi = 0; qi < mission.qn; qi++) {
+                bbox[qi] = {SP_INFINITY, SP_INFINITY, SP_INFINITY, -SP_INFINITY, -SP_INFINITY, -SP_INFINITY};
+                for (const auto &box : planResult_ptr->SFC[qi]) {
+                    for (int k = 0; k < 3; k++) {
+                        bbox[qi][k] = std::min(bbox[qi][k], box.first[k]);
+                        bbox[qi][k + 3] = std::max(bbox[qi][k + 3], box.first[k + 3]);
                     }
                 }
-                planResult_ptr->SFC[qi][box_max - 1].second = makespan;
+                for (int k = 0; k < 3; k++) {
+                    double margin = (k == 2) ? mission.quad_size[qi] * param.downwash : mission.quad_size[qi];
+                    bbox[qi][k] -= margin;
+                    bbox[qi][k + 3] += margin;
+                }
             }
 
+            std::vector<int> order(mission.qn);
+            for (int qi = 0; qi < mission.qn; qi++) {
+                order[qi] = qi;
+            }
+            std::sort(order.begin(), order.end(), [&bbox](int qi, int qj) {
+                return bbox[qi][0] < bbox[qj][0];
+            });
+
+            rel_pairs.clear();
+            std::vector<int> active;
+            for (int qi : order) {
+                active.erase(std::remove_if(active.begin(), active.end(), [&bbox, qi](int qj) {
+                    return bbox[qj][3] < bbox[qi][0];
+                }), active.end());
+
+                for (int qj : active) {
+                    if (bbox[qi][1] > bbox[qj][4] || bbox[qj][1] > bbox[qi][4] ||
+                        bbox[qi][2] > bbox[qj][5] || bbox[qj][2] > bbox[qi][5]) {
+                        continue;
+                    }
+                    if (isRelPairInteracting(qi, qj)) {
+                        rel_pairs.emplace_back(std::min(qi, qj), std::max(qi, qj));
+                    }
+                }
+                active.emplace_back(qi);
+            }
+            std::sort(rel_pairs.begin(), rel_pairs.end());
+
             timer.stop();
-            ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds());
+            ROS_INFO_STREAM("Corridor: RSFC pairs=" << rel_pairs.size() << "/" << mission.qn * (mission.qn - 1) / 2
+                            << ", broad phase runtime=" << timer.elapsedSeconds());
             return true;
         }
 
-        bool updateRelBox() {
+        // Drop the RSFC of the segments in which the SFCs of the pair are already separated by the collision distance.
+        // The normal vector of a dropped segment is zero, and the pairs without active segment are removed.
+        bool updateRedundantRSFC() {
             Timer timer;
 
-            planResult_ptr->RSFC.resize(mission.qn);
+            const auto &T = planResult_ptr->T;
+            int M = T.size() - 1;
+            std::vector<std::vector<int>> box_idx(mission.qn, std::vector<int>(M));
             for (int qi = 0; qi < mission.qn; qi++) {
-                planResult_ptr->RSFC[qi].resize(mission.qn);
-                for (int qj = qi + 1; qj < mission.qn; qj++) {
-                    int path_size = planResult_ptr->initTraj[qi].size();
-                    if (planResult_ptr->initTraj[qi].size() != planResult_ptr->initTraj[qj].size()) {
-                        ROS_ERROR("Corridor: size of initial trajectories must be equal");
-                        return false;
+                int bi = 0;
+                for (int m = 0; m < M; m++) {
+                    while (bi < planResult_ptr->SFC[qi].size() - 1 && planResult_ptr->SFC[qi][bi].second < T[m + 1]) {
+                        bi++;
                     }
+                    box_idx[qi][m] = bi;
+                }
+            }
 
-                    octomap::point3d a, b, c, n, m;
-                    double dist, dist_min;
-                    for (int iter = 1; iter < planResult_ptr->T.size(); iter++) {
-                        a = planResult_ptr->initTraj[qj][iter - 1] - planResult_ptr->initTraj[qi][iter - 1];
-                        b = planResult_ptr->initTraj[qj][iter] - planResult_ptr->initTraj[qi][iter];
+            const RSFC_t &RSFC = planResult_ptr->RSFC;
+            RSFC_t RSFC_pruned;
+            std::vector<std::pair<octomap::point3d, double>> rsfc_pair;
+            int count_active = 0;
+            for (int p = 0; p < RSFC.size(); p++) {
+                int qi = RSFC.pairs[p].first;
+                int qj = RSFC.pairs[p].second;
+                double r = mission.quad_size[qi] + mission.quad_size[qj];
+                bool active = false;
+                rsfc_pair.clear();
+                for (int m = 0; m < M; m++) {
+                    octomap::point3d normal_vector = RSFC.normal[RSFC.findCorridor(p, T[m + 1])];
+                    if (isBoxSeparated(planResult_ptr->SFC[qi][box_idx[qi][m]].first,
+                                       planResult_ptr->SFC[qj][box_idx[qj][m]].first, r)) {
+                        normal_vector = octomap::point3d(0, 0, 0);
+                    } else if (normal_vector.norm() > 0) {
+                        active = true;
+                        count_active++;
+                    }
 
-                        // Coordinate transformation
-                        a.z() = a.z() / param.downwash;
-                        b.z() = b.z() / param.downwash;
+                    if (!rsfc_pair.empty() && rsfc_pair.back().first == normal_vector) {
+                        rsfc_pair.back().second = T[m + 1];
+                    } else {
+                        rsfc_pair.emplace_back(std::make_pair(normal_vector, T[m + 1]));
+                    }
+                }
+                if (active) {
+                    RSFC_pruned.addPair(qi, qj, rsfc_pair);
+                }
+            }
 
-                        // get closest point of L from origin
-                        if (a == b) {
-                            m = a;
-                        } else {
-                            m = a;
-                            dist_min = a.norm();
+            timer.stop();
+            if (log) {
+                ROS_INFO_STREAM("Corridor: active RSFC segments=" << count_active << "/" << RSFC.size() * M
+                                << ", pairs=" << RSFC_pruned.size() << "/" << RSFC.size()
+                                << ", pruning runtime=" << timer.elapsedSeconds());
+            }
+            planResult_ptr->RSFC = std::move(RSFC_pruned);
+            return true;
+        }
 
-                            dist = b.norm();
-                            if (dist_min > dist) {
-                                m = b;
-                                dist_min = dist;
-                            }
+        bool updateRelBox() {
+            Timer timer;
 
-                            n = b - a;
-                            n.normalize();
-                            c = a - n * a.dot(n);
-                            dist = c.norm();
-                            if ((c - a).dot(c - b) < 0 && dist_min > dist) {
-                                m = c;
-                            }
-                        }
-                        m.normalize();
+            if (!buildRSFC(false)) {
+                return false;
+            }
 
-                        m.z() = m.z() / param.downwash;
-                        if (m.norm() == 0) {
-                            ROS_ERROR("Corridor: initial trajectories are collided with each other");
-                            return false;
-                        }
+            timer.stop();
+            ROS_INFO_STREAM("Corridor: RSFC runtime=" << timer.elapsedSeconds());
+            return true;
+        }
+
+        bool updateRelBoxPair(int qi, int qj, std::vector<std::pair<octomap::point3d, double>>* rsfc_pair) {
+            int path_size = planResult_ptr->initTraj[qi].size();
+            if (planResult_ptr->initTraj[qi].size() != planResult_ptr->initTraj[qj].size()) {
+                ROS_ERROR("Corridor: size of initial trajectories must be equal");
+                return false;
+            }
+
+            octomap::point3d a, b, c, n, m;
+            double dist, dist_min;
+            for (int iter = 1; iter < planResult_ptr->T.size(); iter++) {
+                a = planResult_ptr->initTraj[qj][iter - 1] - planResult_ptr->initTraj[qi][iter - 1];
+                b = planResult_ptr->initTraj[qj][iter] - planResult_ptr->initTraj[qi][iter];
+
+                // Coordinate transformation
+                a.z() = a.z() / param.downwash;
+                b.z() = b.z() / param.downwash;
 
-                        planResult_ptr->RSFC[qi][qj].emplace_back(std::make_pair(m, planResult_ptr->T[iter]));
+                // get closest point of L from origin
+                if (a == b) {
+                    m = a;
+                } else {
+                    m = a;
+                    dist_min = a.norm();
+
+                    dist = b.norm();
+                    if (dist_min > dist) {
+                        m = b;
+                        dist_min = dist;
+                    }
+
+                    n = b - a;
+                    n.normalize();
+                    c = a - n * a.dot(n);
+                    dist = c.norm();
+                    if ((c - a).dot(c - b) < 0 && dist_min > dist) {
+                        m = c;
                     }
                 }
-            }
+                m.normalize();
 
-            timer.stop();
-            ROS_INFO_STREAM("Corridor: RSFC runtime=" << timer.elapsedSeconds());
+                m.z() = m.z() / param.downwash;
+                if (m.norm() == 0) {
+                    ROS_ERROR("Corridor: initial trajectories are collided with each other");
+                    return false;
+                }
+
+                rsfc_pair->emplace_back(std::make_pair(m, planResult_ptr->T[iter]));
+            }
             return true;
         }
 
@@ -451,203 +1041,215 @@ namespace SwarmPlanning {
                 }
 
                 // Generate box time segment
-                int box_max = planResult_ptr->SFC[qi].size();
-                int path_max = planResult_ptr->initTraj[qi].size();
-                // 记录每个盒子与轨迹点之间的关系
-                Eigen::MatrixXd box_log = Eigen::MatrixXd::Zero(box_max, path_max);
-                // 用于存储时间戳
-                std::vector<int> ts;
-                // 填充 box_log, 用于调试
-                for (int i = 0; i < box_max; i++) {
-                    for (int j = 0; j < path_max; j++) {
-                        if (isPointInBox(planResult_ptr->initTraj[qi][j], planResult_ptr->SFC[qi][i].first)) {
-                            if (j == 0) {
-                                box_log(i, j) = 1;
-                            } else {
-                                box_log(i, j) = box_log(i, j - 1) + 1;
-                            }
-                        }
-                    }
-                }
+                updateFlatBoxTime(qi);
+            }
 
-                if (log) {
-                    std::cout << qi << std::endl;
-                    std::cout << box_log << std::endl;
-                }
+            timer.stop();
+            ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds());
+            return true;
+        }
 
-                int box_iter = 0;
-                // 循环遍历所有的轨迹点
-                for (int path_iter = 0; path_iter < path_max; path_iter++) {
-                    // 如果达到最后一个盒子, 终止循环
-                    if (box_iter >= box_max - 1) {
-                        break;
-                    }
-                    // 检查当前盒子和下一个盒子是否都包含当前的轨迹点 path_iter
-                    if (box_log(box_iter, path_iter) > 0 && box_log(box_iter + 1, path_iter) > 0) {
-                        int count = 1;
-                        while (path_iter + count < path_max && box_log(box_iter, path_iter + count) > 0
-                               && box_log(box_iter + 1, path_iter + count) > 0) {
-                            count++;
-                        }
-                        double obs_index = path_iter + count / 2;
-                        // 为每个盒子的中心点分配时间戳
-                        planResult_ptr->SFC[qi][box_iter].second = obs_index * param.time_step;
-                        planResult_ptr->T.emplace_back(obs_index);
+        bool updateFlatRelBox() {
+            Timer timer;
 
-                        path_iter = path_iter + count / 2;
-                        box_iter++;
-                    }
-                }
-                // 确保最后一个盒子的时间戳设置为整个路径规划的总时间长度, 这样可以保证路径规划在预定的时间内完成.
-                planResult_ptr->SFC[qi][box_max - 1].second = makespan * param.time_step;
+            if (!buildRSFC(true)) {
+                return false;
             }
 
             timer.stop();
-            ROS_INFO_STREAM("Corridor: SFC runtime=" << timer.elapsedSeconds());
+            ROS_INFO_STREAM("Corridor: RSFC runtime=" << timer.elapsedSeconds());
             return true;
         }
 
-        bool updateFlatRelBox() {
+        // ts collects the segment times added by the sector switching of this pair
+        bool updateFlatRelBoxPair(int qi, int qj, std::vector<std::pair<octomap::point3d, double>>* rsfc_pair,
+                                  std::vector<double>* ts) {
             int sector_range[6] = {-3, -2, -1, 1, 2, 3};
 
-            Timer timer;
-
-            planResult_ptr->RSFC.resize(mission.qn);
-            for (int qi = 0; qi < mission.qn; qi++) {
-                planResult_ptr->RSFC[qi].resize(mission.qn);
-                for (int qj = qi + 1; qj < mission.qn; qj++) {
-                    // 计算两个无人机初始轨迹的最大和最小长度
-                    int path_max = std::max<int>(planResult_ptr->initTraj[qi].size(),
-                                                 planResult_ptr->initTraj[qj].size());
-                    int path_min = std::min<int>(planResult_ptr->initTraj[qi].size(),
-                                                 planResult_ptr->initTraj[qj].size());
-                    Eigen::MatrixXd sector_log = Eigen::MatrixXd::Zero(6, path_max);
-                    // 遍历每个轨迹点
-                    for (int iter = 0; iter < path_max; iter++) {
-                        // Get rel_pose
-                        int rel_pose[4];
-                        double dx, dy, dz;
-
-                        if (iter < path_min) {
-                            dx = round((planResult_ptr->initTraj[qj][iter].x()
-                                    - planResult_ptr->initTraj[qi][iter].x()) / param.grid_xy_res);
-                            dy = round((planResult_ptr->initTraj[qj][iter].y()
-                                    - planResult_ptr->initTraj[qi][iter].y()) / param.grid_xy_res);
-                            dz = round((planResult_ptr->initTraj[qj][iter].z()
-                                    - planResult_ptr->initTraj[qi][iter].z()) / param.grid_z_res);
-                        } else if (planResult_ptr->initTraj[qi].size() == path_min) {
-                            dx = round((planResult_ptr->initTraj[qj][iter].x()
-                                    - planResult_ptr->initTraj[qi][path_min - 1].x()) / param.grid_xy_res);
-                            dy = round((planResult_ptr->initTraj[qj][iter].y()
-                                    - planResult_ptr->initTraj[qi][path_min - 1].y()) / param.grid_xy_res);
-                            dz = round((planResult_ptr->initTraj[qj][iter].z()
-                                    - planResult_ptr->initTraj[qi][path_min - 1].z()) / param.grid_z_res);
+            // 计算两个无人机初始轨迹的最大和最小长度
+            int path_max = std::max<int>(planResult_ptr->initTraj[qi].size(),
+                                         planResult_ptr->initTraj[qj].size());
+            int path_min = std::min<int>(planResult_ptr->initTraj[qi].size(),
+                                         planResult_ptr->initTraj[qj].size());
+            Eigen::MatrixXd sector_log = Eigen::MatrixXd::Zero(6, path_max);
+            // 遍历每个轨迹点
+            for (int iter = 0; iter < path_max; iter++) {
+                // Get rel_pose
+                int rel_pose[4];
+                double dx, dy, dz;
+
+                if (iter < path_min) {
+                    dx = round((planResult_ptr->initTraj[qj][iter].x()
+                            - planResult_ptr->initTraj[qi][iter].x()) / param.grid_xy_res);
+                    dy = round((planResult_ptr->initTraj[qj][iter].y()
+                            - planResult_ptr->initTraj[qi][iter].y()) / param.grid_xy_res);
+                    dz = round((planResult_ptr->initTraj[qj][iter].z()
+                            - planResult_ptr->initTraj[qi][iter].z()) / param.grid_z_res);
+                } else if (planResult_ptr->initTraj[qi].size() == path_min) {
+                    dx = round((planResult_ptr->initTraj[qj][iter].x()
+                            - planResult_ptr->initTraj[qi][path_min - 1].x()) / param.grid_xy_res);
+                    dy = round((planResult_ptr->initTraj[qj][iter].y()
+                            - planResult_ptr->initTraj[qi][path_min - 1].y()) / param.grid_xy_res);
+                    dz = round((planResult_ptr->initTraj[qj][iter].z()
+                            - planResult_ptr->initTraj[qi][path_min - 1].z()) / param.grid_z_res);
+                } else {
+                    dx = round((planResult_ptr->initTraj[qj][path_min - 1].x()
+                            - planResult_ptr->initTraj[qi][iter].x()) / param.grid_xy_res);
+                    dy = round((planResult_ptr->initTraj[qj][path_min - 1].y()
+                            - planResult_ptr->initTraj[qi][iter].y()) / param.grid_xy_res);
+                    dz = round((planResult_ptr->initTraj[qj][path_min - 1].z()
+                            - planResult_ptr->initTraj[qi][iter].z()) / param.grid_z_res);
+                }
+                // Caution: (q1_size+q2_size)/grid_size should be small enough!
+                // 存储符号信息, 用于确定两架无人机在各个轴向上的相对朝向
+                // 判断j的位置 with respect to i
+                rel_pose[1] = (dx > SP_EPSILON_FLOAT) - (dx < -SP_EPSILON_FLOAT);
+                rel_pose[2] = (dy > SP_EPSILON_FLOAT) - (dy < -SP_EPSILON_FLOAT);
+                rel_pose[3] = (dz > SP_EPSILON_FLOAT) - (dz < -SP_EPSILON_FLOAT);
+
+                // Save sector information
+                for (int i = 0; i < 6; i++) {
+                    int sector = sector_range[i];
+                    int sgn = (i > 2) - (i < 3);
+                    if (rel_pose[abs(sector)] * sgn > 0) {
+                        if (iter == 0) {
+                            sector_log(i, iter) = 1;
                         } else {
-                            dx = round((planResult_ptr->initTraj[qj][path_min - 1].x()
-                                    - planResult_ptr->initTraj[qi][iter].x()) / param.grid_xy_res);
-                            dy = round((planResult_ptr->initTraj[qj][path_min - 1].y()
-                                    - planResult_ptr->initTraj[qi][iter].y()) / param.grid_xy_res);
-                            dz = round((planResult_ptr->initTraj[qj][path_min - 1].z()
-                                    - planResult_ptr->initTraj[qi][iter].z()) / param.grid_z_res);
+                            // 如果无人机从一个轨迹点移动到下一个轨迹点而没有离开扇区 i, 那么这个扇区的计数
+                            sector_log(i, iter) = sector_log(i, iter - 1) + 1;
                         }
-                        // Caution: (q1_size+q2_size)/grid_size should be small enough!
-                        // 存储符号信息, 用于确定两架无人机在各个轴向上的相对朝向
-                        // 判断j的位置 with respect to i
-                        rel_pose[1] = (dx > SP_EPSILON_FLOAT) - (dx < -SP_EPSILON_FLOAT);
-                        rel_pose[2] = (dy > SP_EPSILON_FLOAT) - (dy < -SP_EPSILON_FLOAT);
-                        rel_pose[3] = (dz > SP_EPSILON_FLOAT) - (dz < -SP_EPSILON_FLOAT);
-
-                        // Save sector information
+                    }
+                }
+            }
+
+            //find minimum jump sector path (heuristic greedy search)
+            // 从轨迹最后一个点前向搜索
+            int iter = path_max - 1;
+            // 存储下一个扇区的索引
+            int sector_next = -1;
+            // 存储该扇区覆盖的轨迹点数
+            int count_next = sector_log.col(iter).maxCoeff(&sector_next);
+
+            // Corridors are found backward, reversed before being stored
+            rsfc_pair->emplace_back(
+                    std::make_pair(sec2normVec(sector_range[sector_next]), makespan * param.time_step));
+            // 跳过当前扇区覆盖的轨迹点
+            iter = iter - count_next + 1;
+
+            while (iter > 1) {
+                int sector_curr;
+                int count;
+
+                // if there is no intersection then allow to jump sector
+                // 构建最小跳跃扇区路径
+                // except jumping through quadrotor (i.e. +x -> -x jumping is not allowed)
+                // 表示轨迹点 iter处有跳跃
+                if (sector_log.col(iter).maxCoeff(&sector_curr) <= 1) {
+                    // 找到轨迹点
+                    iter = iter - 1;
+                    // 计算与下一个扇区相反的方向的扇区
+                    int sector_opp = 6 - 1 - sector_next;
+
+                    if (sector_log.col(iter).maxCoeff(&sector_curr) <= 0) {
+                        ROS_ERROR("Corridor: Invalid initial trajectory, there is missing link");
+                        std::cout << sector_log << std::endl;
+                        return false;
+                    } else if (sector_curr == sector_opp) {
+                        bool flag = false;
                         for (int i = 0; i < 6; i++) {
-                            int sector = sector_range[i];
-                            int sgn = (i > 2) - (i < 3);
-                            if (rel_pose[abs(sector)] * sgn > 0) {
-                                if (iter == 0) {
-                                    sector_log(i, iter) = 1;
-                                } else {
-                                    // 如果无人机从一个轨迹点移动到下一个轨迹点而没有离开扇区 i, 那么这个扇区的计数
-                                    sector_log(i, iter) = sector_log(i, iter - 1) + 1;
-                                }
+                            // 检查是否有合法扇区
+                            if (i != sector_opp &&
+                                sector_log(i, iter) == sector_log.col(iter).maxCoeff(&sector_curr)) {
+                                flag = true;
+                                break;
                             }
                         }
+                        if (!flag) {
+                            ROS_ERROR("Corridor: Invalid Path, jumping through quadrotor");
+                            std::cout << sector_log << std::endl;
+                            return false;
+                        }
                     }
+                    count = 0;
+                } else {
+                    count = 1;
+                    // search for the middle waypoint among the intersection of two sequential convex sets
+                    while (sector_log(sector_curr, iter + count) > 0) {
+                        count++;
+                    }
+                }
 
-                    //find minimum jump sector path (heuristic greedy search)
-                    // 从轨迹最后一个点前向搜索
-                    int iter = path_max - 1;
-                    // 存储下一个扇区的索引
-                    int sector_next = -1;
-                    // 存储该扇区覆盖的轨迹点数
-                    int count_next = sector_log.col(iter).maxCoeff(&sector_next);
-
-                    planResult_ptr->RSFC[qi][qj].emplace_back(
-                            std::make_pair(sec2normVec(sector_range[sector_next]), makespan * param.time_step));
-                    // 跳过当前扇区覆盖的轨迹点
-                    iter = iter - count_next + 1;
-
-                    while (iter > 1) {
-                        int sector_curr;
-                        int count;
-
-                        // if there is no intersection then allow to jump sector
-                        // 构建最小跳跃扇区路径
-                        // except jumping through quadrotor (i.e. +x -> -x jumping is not allowed)
-                        // 表示轨迹点 iter处有跳跃
-                        if (sector_log.col(iter).maxCoeff(&sector_curr) <= 1) {
-                            // 找到轨迹点
-                            iter = iter - 1;
-                            // 计算与下一个扇区相反的方向的扇区
-                            int sector_opp = 6 - 1 - sector_next;
-
-                            if (sector_log.col(iter).maxCoeff(&sector_curr) <= 0) {
-                                ROS_ERROR("Corridor: Invalid initial trajectory, there is missing link");
-                                std::cout << sector_log << std::endl;
-                                return false;
-                            } else if (sector_curr == sector_opp) {
-                                bool flag = false;
-                                for (int i = 0; i < 6; i++) {
-                                    // 检查是否有合法扇区
-                                    if (i != sector_opp &&
-                                        sector_log(i, iter) == sector_log.col(iter).maxCoeff(&sector_curr)) {
-                                        flag = true;
-                                        break;
-                                    }
-                                }
-                                if (!flag) {
-                                    ROS_ERROR("Corridor: Invalid Path, jumping through quadrotor");
-                                    std::cout << sector_log << std::endl;
-                                    return false;
-                                }
-                            }
-                            count = 0;
-                        } else {
-                            count = 1;
-                            // search for the middle waypoint among the intersection of two sequential convex sets
-                            while (sector_log(sector_curr, iter + count) > 0) {
-                                count++;
-                            }
-                        }
+                double rel_index;
+                if (count == 0) {
+                    rel_index = iter + 0.5;
+                } else {
+                    rel_index = floor(iter + count / 2.0);
+                }
 
-                        double rel_index;
-                        if (count == 0) {
-                            rel_index = iter + 0.5;
-                        } else {
-                            rel_index = floor(iter + count / 2.0);
-                        }
+                rsfc_pair->emplace_back(std::make_pair(sec2normVec(sector_range[sector_curr]),
+                                                      rel_index * param.time_step));
+                ts->emplace_back(rel_index);
 
-                        planResult_ptr->RSFC[qi][qj].insert(planResult_ptr->RSFC[qi][qj].begin(),
-                                                            std::make_pair(sec2normVec(sector_range[sector_curr]),
-                                                                           rel_index * param.time_step));
-                        planResult_ptr->T.emplace_back(rel_index);
+                sector_next = sector_curr;
+                iter = iter - sector_log.col(iter).maxCoeff() + 1;
+            }
+            std::reverse(rsfc_pair->begin(), rsfc_pair->end());
+            return true;
+        }
 
-                        sector_next = sector_curr;
-                        iter = iter - sector_log.col(iter).maxCoeff() + 1;
+        // Generate RSFC of the pairs in rel_pairs in parallel.
+        // Workers append to their own buffers, which are merged in pair order so that the result is deterministic.
+        // If changed is given, RSFC of the pairs of unchanged agents are copied from the last update.
+        bool buildRSFC(bool flat, const std::vector<bool> &changed = {}) {
+            struct PairResult {
+                int p;
+                std::vector<std::pair<octomap::point3d, double>> rsfc_pair;
+                std::vector<double> ts;
+            };
+
+            int num_threads = getNumThreads(param.num_threads);
+            std::vector<std::vector<PairResult>> buffers(num_threads);
+            std::atomic<bool> success(true);
+            parallel_for(rel_pairs.size(), num_threads, [&](int p, int tid) {
+                if (!success) {
+                    return;
+                }
+                PairResult result;
+                result.p = p;
+                int qi = rel_pairs[p].first;
+                int qj = rel_pairs[p].second;
+                int cp = changed.empty() || changed[qi] || changed[qj] ? -1 : cache_RSFC.findPair(qi, qj);
+                if (cp >= 0) {
+                    for (int ri = cache_RSFC.offset[cp]; ri < cache_RSFC.offset[cp + 1]; ri++) {
+                        result.rsfc_pair.emplace_back(std::make_pair(cache_RSFC.normal[ri], cache_RSFC.time[ri]));
                     }
+                    buffers[tid].emplace_back(std::move(result));
+                    return;
+                }
+                bool valid = flat ? updateFlatRelBoxPair(qi, qj, &result.rsfc_pair, &result.ts)
+                                  : updateRelBoxPair(qi, qj, &result.rsfc_pair);
+                if (!valid) {
+                    success = false;
+                    return;
                 }
+                buffers[tid].emplace_back(std::move(result));
+            });
+            if (!success) {
+                return false;
             }
 
-            timer.stop();
-            ROS_INFO_STREAM("Corridor: RSFC runtime=" << timer.elapsedSeconds());
+            std::vector<const PairResult*> results(rel_pairs.size());
+            for (const auto &buffer : buffers) {
+                for (const auto &result : buffer) {
+                    results[result.p] = &result;
+                }
+            }
+            planResult_ptr->RSFC.clear();
+            for (int p = 0; p < rel_pairs.size(); p++) {
+                planResult_ptr->RSFC.addPair(rel_pairs[p].first, rel_pairs[p].second, results[p]->rsfc_pair);
+                planResult_ptr->T.insert(planResult_ptr->T.end(), results[p]->ts.begin(), results[p]->ts.end());
+            }
+            return true;
         }
 
         octomap::point3d sec2normVec(int sector) {
@@ -1,19 +1,21 @@
 #pragma once
 
+#include <array>
+
 // EIGEN
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
-
-// CPLEX
-#include <ilcplex/ilocplex.h>
+#include <Eigen/SparseCholesky>
 
 // Submodules
+#include <bernstein.hpp>
 #include <rbp_corridor.hpp>
 #include <init_traj_planner.hpp>
 #include <mission.hpp>
 #include <param.hpp>
-
-ILOSTLBEGIN
+#include <parallel.hpp>
+#include <qp_problem.hpp>
+#include <qp_solver.hpp>
 
 namespace SwarmPlanning {
     class RBPPlanner {
@@ -26,52 +28,70 @@ namespace SwarmPlanning {
             phi = param.phi; // desired derivatives
             N = mission.qn; // the number of agents
             outdim = 3; // the number of outputs (x,y,z)
-
-            setBatch(0);
+            bernstein_basis = createBernsteinBasis(n, phi);
         }
 
         bool update(bool log, SwarmPlanning::PlanResult* _planResult_ptr) {
             planResult_ptr = _planResult_ptr;
+            if (!bernstein_basis) {
+                ROS_ERROR_STREAM("RBPPlanner: n=" << n << ", phi=" << phi << " is not supported, 2phi-1<=n<="
+                                                  << BERNSTEIN_MAX_N << " and phi<=4");
+                return false;
+            }
             M = planResult_ptr->T.size() - 1; // the number of segments
             offset_quad = M * (n + 1);
             offset_seg = n + 1;
 
             coef.resize(N);
+            ctrl_points.resize(N);
             for (int qi = 0; qi < N; qi++) {
                 coef[qi] = Eigen::MatrixXd::Zero(offset_quad, outdim);
+                ctrl_points[qi] = Eigen::MatrixXd::Zero(offset_quad, outdim);
             }
 
-            IloEnv env;
             Timer timer;
-            try {
-                // Construct constraint matrix
-                timer.reset();
-                buildConstMtx();
-                timer.stop();
-                ROS_INFO_STREAM("RBPPlanner: Constraint Matrix runtime=" << timer.elapsedSeconds());
 
-                // Solve QP
-                timer.reset();
-                solveQP(env, log);
-                timer.stop();
-                ROS_INFO_STREAM("RBPPlanner: QP runtime=" << timer.elapsedSeconds());
-                ROS_INFO_STREAM("RBPPlanner: x size=" << count_x);
-                ROS_INFO_STREAM("RBPPlanner: eq const size=" << count_eq);
-                ROS_INFO_STREAM("RBPPlanner: ineq const size=" << count_lq);
-            }
-            catch (IloException &e) {
-                ROS_ERROR_STREAM("RBPPlanner: CPLEX Concert exception caught: " << e);
+            // Group the agents into batches, the interaction-aware algorithms use RSFC
+            timer.reset();
+            setBatch(param.batch_alg);
+            timer.stop();
+            ROS_INFO_STREAM("RBPPlanner: setBatch runtime=" << timer.elapsedSeconds());
+
+            // Construct constraint matrix
+            timer.reset();
+            buildConstMtx();
+            timer.stop();
+            ROS_INFO_STREAM("RBPPlanner: Constraint Matrix runtime=" << timer.elapsedSeconds());
+
+            // Solve QP
+            timer.reset();
+            if (!solveQP(log)) {
                 return false;
             }
-            catch (...) {
-                ROS_ERROR("RBPPlanner: CPLEX Unknown exception caught");
-                return false;
+            timer.stop();
+            ROS_INFO_STREAM("RBPPlanner: QP runtime=" << timer.elapsedSeconds());
+            ROS_INFO_STREAM("RBPPlanner: x size=" << count_x);
+            ROS_INFO_STREAM("RBPPlanner: eq const size=" << count_eq);
+            ROS_INFO_STREAM("RBPPlanner: ineq const size=" << count_lq);
+
+            // Reallocate the segment time and solve QP again from the last solution
+            if (!param.sequential || param.batch_iter > 0) {
+                std::vector<double> T_init = planResult_ptr->T;
+                for (int r = 0; r < param.time_refine; r++) {
+                    timer.reset();
+                    if (!refineTime(T_init, log)) {
+                        ROS_WARN("RBPPlanner: Failed to refine segment time, keep the last solution");
+                        break;
+                    }
+                    timer.stop();
+                    ROS_INFO_STREAM("RBPPlanner: time refinement " << r << " runtime=" << timer.elapsedSeconds()
+                                                                   << ", makespan=" << planResult_ptr->T.back());
+                }
             }
-            env.end();
 
             if(param.time_scale) {
                 timer.reset();
-                timeScale();
+                timeScale(log);
                 timer.stop();
                 ROS_INFO_STREAM("RBPPlanner: timeScale runtime=" << timer.elapsedSeconds());
             }
@@ -89,180 +109,333 @@ namespace SwarmPlanning {
 
         SwarmPlanning::PlanResult* planResult_ptr;
         std::vector<std::vector<int>> batches;
+        std::vector<int> batch_of, batch_slot; // batch of each agent and its index in the batch
+        std::vector<std::vector<int>> batch_levels; // batches of each level, which are not coupled to each other
         int M, n, phi, N, outdim, offset_quad, offset_seg;
-        IloNum count_x, count_eq, count_lq;
-
-        // std::shared_ptr<Eigen::MatrixXd> Q_obj, Aeq_obj, Alq_obj, deq_obj, dlq_obj;
-        Eigen::MatrixXd Q_base, Aeq_base, Alq, deq, dlq, basis;
+        int count_x, count_eq, count_lq;
+        const double TIME_REFINE_MAX_RATIO = 2; // the largest change of a segment time from the initial one
+
+        std::shared_ptr<BernsteinBasis> bernstein_basis; // specialized for (n, phi)
+        Eigen::MatrixXd Q_base, Aeq_base;
+        Eigen::MatrixXd deq; // start and goal conditions of each agent, (N * 2 * phi) x outdim
+        std::vector<int> box_index; // SFC box of the m-th segment of qi, indexed by qi * M + m
+        std::vector<int> rsfc_index; // RSFC of the m-th segment of pair p, indexed by p * M + m
         Eigen::MatrixXd dummy;
         std::vector<Eigen::MatrixXd> coef;
+        std::vector<Eigen::MatrixXd> ctrl_points; // Bernstein control points of coef, they do not change by time scaling
+
+        // QP, solver and solution of each batch, kept across iterations and time refinements.
+        // Only the bounds of the RSFC rows that fix agents out of the batch to dummy change,
+        // dummy_rows holds (row, pair, control point) of those rows.
+        std::vector<QPProblem> batch_qps;
+        std::vector<std::shared_ptr<QPSolver>> qp_solvers;
+        std::vector<Eigen::VectorXd> batch_vals;
+        std::vector<std::vector<std::array<int, 3>>> dummy_rows;
+        std::vector<double> batch_cost_const; // cost of the particular solutions, which is not in the QP
+
+        Eigen::SparseMatrix<double, Eigen::RowMajor> Aeq_base_sparse;
+
+        // The control points of an agent along an axis are x = R * d + Z * z, where R is particular_map, d is its
+        // start and goal condition in deq and z are its QP variables. If condensed, the columns of Z are a basis of
+        // the nullspace of the equality constraints, one per free control point, and R * d is the minimum cost
+        // trajectory without the inequality constraints. Otherwise Z is the identity, R is zero and the equalities
+        // are rows of the QP. Z and R depend only on the segment time, so they are shared by all agents.
+        bool condensed; // param.condense, unless there is no free control point
+        int offset_free; // the number of QP variables of an agent along an axis
+        Eigen::SparseMatrix<double, Eigen::RowMajor> Z;
+        Eigen::MatrixXd particular_map;
+        std::vector<int> free_index; // QP variable of each control point if x = R * d + z there, -1 otherwise
+        Eigen::SparseMatrix<double> Q_free; // z'Z'QZz
+        Eigen::MatrixXd c_free; // linear cost of z per d, 2 Z'QR
+        Eigen::MatrixXd particular; // R * d of all agents, (N * offset_quad) x outdim
+        Eigen::MatrixXd particular_cost; // R * d cost of each agent along each axis, N x outdim
 
         void buildConstMtx() {
             build_Q_base();
-            build_Aeq_base();
             build_deq();
             build_dlq();
+            buildTimeMtx();
 
             if (param.sequential) {
                 build_dummy();
             }
         }
 
-        void solveQP(const IloEnv &env, bool log) {
-            Timer timer;
-            IloNum total_cost = 0;
+        // Matrices that depend on the segment time
+        void buildTimeMtx() {
+            build_Aeq_base();
+            Aeq_base_sparse = Aeq_base.sparseView();
+            build_free();
+        }
 
-            IloCplex cplex(env);
-//            cplex.setParam(IloCplex::Param::TimeLimit, 0.04);
+        bool solveQP(bool log) {
+            double total_cost = 0;
 
             // publish Initial trajectory
             if(param.sequential && param.batch_iter == 0){
-                // Translate Bernstein basis to Polynomial coefficients
-                for (int k = 0; k < outdim; k++) {
-                    for (int qi = 0; qi < N; qi++) {
-                        for (int m = 0; m < M; m++) {
-                            Eigen::MatrixXd c = Eigen::MatrixXd::Zero(1, n + 1);
-                            Eigen::MatrixXd tm;
-                            timeMatrix(1.0 / (planResult_ptr->T[m+1] - planResult_ptr->T[m]), &tm);
-                            tm = basis * tm;
-
-                            for (int i = 0; i < n + 1; i++) {
-                                c = c + dummy(qi * offset_quad + m * offset_seg + i, k) * tm.row(i);
-                            }
-                            coef[qi].block(m * offset_seg, k, n + 1, 1) = c.transpose();
-                        }
+                for (int qi = 0; qi < N; qi++) {
+                    for (int k = 0; k < outdim; k++) {
+                        setCoef(qi, k, dummy.block(qi * offset_quad, k, offset_quad, 1));
                     }
-                    timer.stop();
                 }
-                return;
+                return true;
             }
 
+            // One solver instance per batch, the batches of the same level are solved concurrently
+            // The solutions of the last call are the initial guesses after the time refinement
+            if (qp_solvers.size() != param.batch_iter) {
+                setBatchLevels();
+                bool concurrent = false;
+                for (const auto &level : batch_levels) {
+                    concurrent |= getNumThreads(param.num_threads) > 1 && level.size() > 1;
+                }
+                qp_solvers.resize(param.batch_iter);
+                for (int l = 0; l < param.batch_iter; l++) {
+                    std::string log_path = param.package_path + "/log/QPmodel" +
+                                           (param.batch_iter > 1 ? "_" + std::to_string(l) : "") + ".lp";
+                    qp_solvers[l] = createQPSolver(param, log, log_path, concurrent);
+                }
+                if (param.sequential) {
+                    ROS_INFO_STREAM("RBPPlanner: " << param.batch_iter << " batches in " << batch_levels.size()
+                                                   << " levels");
+                }
+                batch_qps.assign(param.batch_iter, QPProblem());
+                batch_cost_const.assign(param.batch_iter, 0);
+                batch_vals.assign(param.batch_iter, Eigen::VectorXd());
+                dummy_rows.assign(param.batch_iter, std::vector<std::array<int, 3>>());
+            }
             for (int iter = 0; iter < param.iteration; iter++) {
                 total_cost = 0;
-                for (int l = 0; l < param.batch_iter; l++) {
-                    timer.reset();
-                    IloModel model(env);
-                    IloNumVarArray var(env);
-                    IloRangeArray con(env);
-
-                    populatebyrow(model, var, con, l);
-                    cplex.extract(model);
-                    if (log) {
-                        std::string QPmodel_path = param.package_path + "/log/QPmodel.lp";
-                        cplex.exportModel(QPmodel_path.c_str());
-                    } else {
-                        cplex.setOut(env.getNullStream());
-                    }
-
-                    // Optimize the problem and obtain solution.
-                    if (!cplex.solve()) {
-                        ROS_ERROR("RBPPlanner: Failed to optimize QP");
-                        throw (-1);
-                    }
+                for (const auto &level : batch_levels) {
+                    std::vector<double> costs(level.size(), 0);
+                    std::vector<char> success(level.size(), false);
+                    parallel_for(level.size(), param.num_threads, [&](int b, int tid) {
+                        int l = level[b];
+                        Timer batch_timer;
+                        QPProblem &qp = batch_qps[l];
+                        Eigen::VectorXd &vals = batch_vals[l];
+                        bool solved;
+                        if (iter == 0) {
+                            buildQP(l, &qp);
+                            if (l == param.batch_iter - 1) {
+                                count_x = qp.cols();
+                                count_eq = qp.num_eq;
+                                count_lq = qp.rows() - qp.num_eq;
+                            }
 
-                    IloNumArray vals(env);
-                    total_cost += cplex.getObjValue();
-                    cplex.getValues(vals, var);
+                            // Optimize the problem and obtain solution.
+                            solved = qp_solvers[l]->solve(qp, &vals, &costs[b]);
+                        } else {
+                            // Update the dummy trajectories, and warm start from the last solution
+                            std::vector<int> rows;
+                            rows.reserve(dummy_rows[l].size());
+                            for (const auto &row : dummy_rows[l]) {
+                                qp.row_lower(row[0]) = getRSFCLowerBound(l, row[1], row[2]);
+                                rows.emplace_back(row[0]);
+                            }
+                            solved = qp_solvers[l]->resolve(qp, rows, &vals, &costs[b]);
+                        }
+                        if (!solved) {
+                            ROS_ERROR_STREAM("RBPPlanner: Failed to optimize QP of batch " << l);
+                            return;
+                        }
+                        success[b] = true;
+                        costs[b] += batch_cost_const[l];
 
-                    // Translate Bernstein basis to Polynomial coefficients
-                    int offset_dim = batches[l].size() * M * (n + 1);
-                    int batch_max_iter = ceil((double)N / (double)param.batch_size);
-                    for (int k = 0; k < outdim; k++) {
-                        for (int qi = 0; qi < N; qi++) {
-                            for (int m = 0; m < M; m++) {
-                                Eigen::MatrixXd c = Eigen::MatrixXd::Zero(1, n + 1);
-                                Eigen::MatrixXd tm;
-                                timeMatrix(1.0 / (planResult_ptr->T[m+1] - planResult_ptr->T[m]), &tm);
-                                tm = basis * tm;
-
-                                int bi = isQuadInBatch(qi, l);
-                                if (bi >= 0) {
-                                    for (int i = 0; i < n + 1; i++) {
-                                        c = c + vals[k * offset_dim + bi * offset_quad + m * offset_seg + i] * tm.row(i);
-                                        if (param.sequential) {
-                                            dummy(qi * offset_quad + m * (n + 1) + i, k) = vals[k * offset_dim + bi * offset_quad + m * offset_seg + i];
-                                        }
-                                    }
-                                    coef[qi].block(m * offset_seg, k, n + 1, 1) = c.transpose();
-                                } else if (param.sequential && param.batch_iter < batch_max_iter) {
-                                    for (int i = 0; i < n + 1; i++) {
-                                        c = c + dummy(qi * offset_quad + m * offset_seg + i, k) * tm.row(i);
-                                    }
-                                    coef[qi].block(m * offset_seg, k, n + 1, 1) = c.transpose();
+                        // Translate Bernstein basis to Polynomial coefficients
+                        int offset_dim = batches[l].size() * offset_free;
+                        for (int bi = 0; bi < batches[l].size(); bi++) {
+                            int qi = batches[l][bi];
+                            for (int k = 0; k < outdim; k++) {
+                                Eigen::VectorXd ctrl = particular.block(qi * offset_quad, k, offset_quad, 1)
+                                                       + Z * vals.segment(k * offset_dim + bi * offset_free, offset_free);
+                                setCoef(qi, k, ctrl);
+                                if (param.sequential) {
+                                    dummy.block(qi * offset_quad, k, offset_quad, 1) = ctrl;
                                 }
                             }
                         }
-                        timer.stop();
+                        batch_timer.stop();
+                        if (param.sequential) {
+                            ROS_INFO_STREAM("RBPPlanner: QP runtime of batch " << l << "=" << batch_timer.elapsedSeconds());
+                            ROS_INFO_STREAM("RBPPlanner: QP cost of batch " << l << "=" << costs[b]);
+                        }
+                    });
+                    if (std::find(success.begin(), success.end(), false) != success.end()) {
+                        ROS_ERROR("RBPPlanner: Failed to optimize QP");
+                        return false;
                     }
-                    if (param.sequential) {
-                        ROS_INFO_STREAM("RBPPlanner: QP runtime of batch " << l << "=" << timer.elapsedSeconds());
-                        ROS_INFO_STREAM("RBPPlanner: QP cost of batch " << l << "=" << cplex.getObjValue());
+                    for (double cost : costs) {
+                        total_cost += cost;
                     }
                 }
                 if (param.iteration > 1)
                     ROS_INFO_STREAM("RBPPlanner: QP iteration " << iter << " total_cost=" << total_cost);
             }
+
+            // The agents out of the solved batches follow the initial trajectory
+            if (param.sequential && param.batch_iter < batches.size()) {
+                for (int l = param.batch_iter; l < batches.size(); l++) {
+                    for (int qi : batches[l]) {
+                        for (int k = 0; k < outdim; k++) {
+                            setCoef(qi, k, dummy.block(qi * offset_quad, k, offset_quad, 1));
+                        }
+                    }
+                }
+            }
             ROS_INFO_STREAM("RBPPlanner: QP total cost=" << total_cost);
+            return true;
         }
 
-        // For all segment of trajectory, check maximum velocity and accelation, and scale the segment time
-        void timeScale() {
-            if (phi != 3 || n != 5) {
-                return;
+        // Translate the Bernstein control points of qi along the k-th axis to polynomial coefficients
+        void setCoef(int qi, int k, const Eigen::Ref<const Eigen::VectorXd> &ctrl) {
+            ctrl_points[qi].col(k) = ctrl;
+            for (int m = 0; m < M; m++) {
+                bernstein_basis->toPolynomial(ctrl.data() + m * offset_seg,
+                                              planResult_ptr->T[m + 1] - planResult_ptr->T[m],
+                                              &coef[qi](m * offset_seg, k));
             }
+        }
 
-            Eigen::MatrixXd coef_der;
-            double time_scale, time_scale_tmp, acc_max;
-            time_scale = 1;
-            for (int qi = 0; qi < N; qi++) {
-                for (int k = 0; k < outdim; k++) {
-                    for (int m = 0; m < M; m++) {
-                        derivative_segment(qi, k, m, &coef_der);
-
-                        time_scale_tmp = scale_to_max_vel(qi, k, m, coef_der);
-                        if (time_scale < time_scale_tmp) {
-                            time_scale = time_scale_tmp;
-                        }
-
-                        time_scale_tmp = scale_to_max_acc(qi, k, m, coef_der);
-                        if (time_scale < time_scale_tmp) {
-                            time_scale = time_scale_tmp;
-                        }
-                    }
-                }
+        // For all segment of trajectory, check maximum velocity and accelation, and scale the segment time.
+        // Scaling the time by s scales the velocity by 1/s and the acceleration by 1/s^2,
+        // so the smallest feasible scale is max(1, vel_max / max_vel, sqrt(acc_max / max_acc)).
+        // A replan starts with the velocity and acceleration of the last plan, which the scaling would change,
+        // so the QP is solved again with the scaled segment time then. If it fails, the time is not scaled.
+        void timeScale(bool log) {
+            std::vector<std::vector<double>> segment_scales(N, std::vector<double>(M, 1));
+            parallel_for(N, param.num_threads, [&](int qi, int tid) {
+                getSegmentScales(qi, &segment_scales[qi]);
+            });
+            double time_scale = 1;
+            for (const auto &scales : segment_scales) {
+                time_scale = std::max(time_scale, *std::max_element(scales.begin(), scales.end()));
             }
 
             ROS_INFO_STREAM("RBPPlanner: Time scale=" << time_scale);
             if (time_scale != 1) {
+                std::vector<double> T_new(M + 1);
+                for (int m = 0; m < M + 1; m++) {
+                    T_new[m] = planResult_ptr->T[0] + time_scale * (planResult_ptr->T[m] - planResult_ptr->T[0]);
+                }
+                if (hasStartDerivative() && !(param.sequential && param.batch_iter == 0)) {
+                    std::vector<double> T_prev = planResult_ptr->T;
+                    std::vector<Eigen::MatrixXd> coef_prev = coef;
+                    std::vector<Eigen::MatrixXd> ctrl_points_prev = ctrl_points;
+                    Eigen::MatrixXd dummy_prev = dummy;
+
+                    setTime(T_new);
+                    buildTimeMtx();
+                    if (solveQP(log)) {
+                        return;
+                    }
+
+                    ROS_WARN("RBPPlanner: Failed to solve QP with the scaled time, keep the last solution");
+                    setTime(T_prev);
+                    buildTimeMtx();
+                    coef = coef_prev;
+                    ctrl_points = ctrl_points_prev;
+                    dummy = dummy_prev;
+                    return;
+                }
+                setTime(T_new);
+
+                // The control points do not change, only the polynomial coefficients
                 for (int qi = 0; qi < N; qi++) {
-                    // trajectory
                     for (int k = 0; k < outdim; k++) {
-                        for (int m = 0; m < M; m++) {
-                            Eigen::MatrixXd tm;
-                            timeMatrix(1.0 / time_scale, &tm);
-
-                            coef[qi].block(m * offset_seg, k, n + 1, 1) =
-                                    tm * coef[qi].block(m * offset_seg, k, n + 1, 1);
-                        }
+                        setCoef(qi, k, ctrl_points[qi].col(k));
                     }
+                }
+            }
+        }
 
-                    // SFC
-                    for (int bi = 0; bi < planResult_ptr->SFC[qi].size(); bi++){
-                        planResult_ptr->SFC[qi][bi].second *= time_scale;
+        // Whether any agent starts with a non-zero velocity or acceleration
+        bool hasStartDerivative() const {
+            for (int qi = 0; qi < N; qi++) {
+                for (int i = outdim; i < std::min(phi, 3) * outdim; i++) {
+                    if (mission.startState[qi][i] != 0) {
+                        return true;
                     }
+                }
+            }
+            return false;
+        }
 
-                    // RSFC
-                    for (int qj = qi + 1; qj < N; qj++){
-                        for (int ri = 0; ri < planResult_ptr->RSFC[qi][qj].size(); ri++){
-                            planResult_ptr->RSFC[qi][qj][ri].second *= time_scale;
-                        }
-                    }
+        // Scale each segment by the largest time scale of all agents in the segment, so that the segment time
+        // stays shared and the RSFC of all pairs keep their alignment. The QP is solved again with the new
+        // segment time from the last solution. The segment time is kept within TIME_REFINE_MAX_RATIO of T_init,
+        // since the cost of a segment grows with dt^(1 - 2 phi) and uneven segments make the QP ill-conditioned.
+        // If the QP fails, the last segment time and solution are restored.
+        bool refineTime(const std::vector<double> &T_init, bool log) {
+            // The agents of the batches which are not solved keep their dummy trajectory and are not scaled
+            std::vector<std::vector<double>> segment_scales(N, std::vector<double>(M, 0));
+            parallel_for(N, param.num_threads, [&](int qi, int tid) {
+                if (batch_of[qi] < param.batch_iter) {
+                    getSegmentScales(qi, &segment_scales[qi]);
                 }
-                // segment time
-                for (int m = 0; m < M + 1; m++) {
-                    planResult_ptr->T[m] *= time_scale;
+            });
+
+            std::vector<double> T_new(M + 1);
+            T_new[0] = planResult_ptr->T[0];
+            for (int m = 0; m < M; m++) {
+                double scale = 0;
+                for (int qi = 0; qi < N; qi++) {
+                    scale = std::max(scale, segment_scales[qi][m]);
                 }
+                double dt = scale * (planResult_ptr->T[m + 1] - planResult_ptr->T[m]);
+                double dt_init = T_init[m + 1] - T_init[m];
+                dt = std::min(std::max(dt, dt_init / TIME_REFINE_MAX_RATIO), dt_init * TIME_REFINE_MAX_RATIO);
+                T_new[m + 1] = T_new[m] + dt;
+            }
+
+            std::vector<double> T_prev = planResult_ptr->T;
+            std::vector<Eigen::MatrixXd> coef_prev = coef;
+            std::vector<Eigen::MatrixXd> ctrl_points_prev = ctrl_points;
+            Eigen::MatrixXd dummy_prev = dummy;
+
+            setTime(T_new);
+            buildTimeMtx();
+            if (solveQP(log)) {
+                return true;
             }
+
+            setTime(T_prev);
+            buildTimeMtx();
+            coef = coef_prev;
+            ctrl_points = ctrl_points_prev;
+            dummy = dummy_prev;
+            return false;
+        }
+
+        // Move the segment time to T_new, the SFC and RSFC times are mapped segment-wise
+        void setTime(const std::vector<double> &T_new) {
+            std::vector<double> T_old = planResult_ptr->T;
+            auto map_time = [&](double t) {
+                int m = std::upper_bound(T_old.begin(), T_old.end(), t) - T_old.begin() - 1;
+                if (m < 0) {
+                    return t - T_old.front() + T_new.front();
+                }
+                if (m >= M) {
+                    return t - T_old.back() + T_new.back();
+                }
+                return T_new[m] + (t - T_old[m]) * (T_new[m + 1] - T_new[m]) / (T_old[m + 1] - T_old[m]);
+            };
+
+            for (int qi = 0; qi < N; qi++) {
+                // SFC
+                for (int bi = 0; bi < planResult_ptr->SFC[qi].size(); bi++){
+                    planResult_ptr->SFC[qi][bi].second = map_time(planResult_ptr->SFC[qi][bi].second);
+                }
+                for (int pi = 0; !planResult_ptr->SFC_poly.empty() && pi < planResult_ptr->SFC_poly[qi].size(); pi++){
+                    planResult_ptr->SFC_poly[qi][pi].second = map_time(planResult_ptr->SFC_poly[qi][pi].second);
+                }
+            }
+            // RSFC
+            for (double &t : planResult_ptr->RSFC.time) {
+                t = map_time(t);
+            }
+            // segment time
+            planResult_ptr->T = T_new;
         }
 
         // generate ros message to transfer planning result
@@ -325,56 +498,126 @@ namespace SwarmPlanning {
 
         // Cost matrix Q
         void build_Q_base() {
-            if (phi == 3 && n == 5) {
-                Q_base = Eigen::MatrixXd::Zero(n + 1, n + 1);
-                Q_base << 720, -1800, 1200, 0, 0, -120,
-                        -1800, 4800, -3600, 0, 600, 0,
-                        1200, -3600, 3600, -1200, 0, 0,
-                        0, 0, -1200, 3600, -3600, 1200,
-                        0, 600, 0, -3600, 4800, -1800,
-                        -120, 0, 0, 1200, -1800, 720;
-
-                basis = Eigen::MatrixXd::Zero(n + 1, n + 1);
-                basis << -1, 5, -10, 10, -5, 1,
-                        5, -20, 30, -20, 5, 0,
-                        -10, 30, -30, 10, 0, 0,
-                        10, -20, 10, 0, 0, 0,
-                        -5, 5, 0, 0, 0, 0,
-                        1, 0, 0, 0, 0, 0;
+            Q_base = bernstein_basis->getCost();
+        }
+
+        // Z, particular_map and the cost of z, see Z
+        void build_free() {
+            // Cost of an agent along an axis, block diagonal with one (n + 1) x (n + 1) block per segment
+            std::vector<Eigen::Triplet<double>> triplets;
+            for (int m = 0; m < M; m++) {
+                double scale = pow(planResult_ptr->T[m + 1] - planResult_ptr->T[m], -2 * phi + 1);
+                for (int i = 0; i < n + 1; i++) {
+                    for (int j = 0; j < n + 1; j++) {
+                        if (Q_base(i, j) != 0) {
+                            triplets.emplace_back(Eigen::Triplet<double>(m * (n + 1) + i, m * (n + 1) + j,
+                                                                         scale * Q_base(i, j)));
+                        }
+                    }
+                }
+            }
+            Eigen::SparseMatrix<double> Q_quad(offset_quad, offset_quad);
+            Q_quad.setFromTriplets(triplets.begin(), triplets.end());
+
+            // The free control points are c_phi, ..., c_n of each segment except the last phi of the last one.
+            // A single segment of degree 2 phi - 1 has none, then the QP is not condensed.
+            std::vector<int> free_points;
+            for (int m = 0; m < M; m++) {
+                for (int i = phi; i < n + 1; i++) {
+                    if (m < M - 1 || i <= n - phi) {
+                        free_points.emplace_back(m * (n + 1) + i);
+                    }
+                }
+            }
+            condensed = param.condense && !free_points.empty();
+
+            free_index.assign(offset_quad, -1);
+            if (!condensed) {
+                offset_free = offset_quad;
+                for (int i = 0; i < offset_quad; i++) {
+                    free_index[i] = i;
+                }
+                Z.resize(offset_quad, offset_quad);
+                Z.setIdentity();
+                particular_map = Eigen::MatrixXd::Zero(offset_quad, 2 * phi);
             } else {
-                ROS_ERROR("RBPPlanner: n should be 5"); //TODO: debug when n is not 5
+                offset_free = free_points.size();
+                for (int f = 0; f < offset_free; f++) {
+                    free_index[free_points[f]] = f;
+                }
+
+                // Each equality row is solved for one control point in [Z R] by substitution. The start rows give
+                // c_i of the first segment, the continuity rows c_j of the m-th segment from the free control points
+                // of the (m - 1)-th, and the goal rows c_(n - i) of the last segment, so Z stays banded.
+                std::vector<std::pair<int, int>> pivots; // (row of Aeq_base, control point)
+                for (int i = 0; i < phi; i++) {
+                    pivots.emplace_back(i, i);
+                }
+                for (int m = 1; m < M; m++) {
+                    for (int j = 0; j < phi; j++) {
+                        pivots.emplace_back(2 * phi + phi * (m - 1) + j, m * (n + 1) + j);
+                    }
+                }
+                for (int i = 0; i < phi; i++) {
+                    pivots.emplace_back(phi + i, (M - 1) * (n + 1) + n - i);
+                }
+
+                Eigen::MatrixXd X = Eigen::MatrixXd::Zero(offset_quad, offset_free + 2 * phi);
+                for (int i = 0; i < offset_quad; i++) {
+                    if (free_index[i] >= 0) {
+                        X(i, free_index[i]) = 1;
+                    }
+                }
+                for (const auto &pivot : pivots) {
+                    int row = pivot.first;
+                    Eigen::RowVectorXd x = Eigen::RowVectorXd::Zero(X.cols());
+                    if (row < 2 * phi) {
+                        x(offset_free + row) = 1;
+                    }
+                    for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(Aeq_base_sparse, row); it; ++it) {
+                        if (it.col() != pivot.second) {
+                            x -= it.value() * X.row(it.col());
+                        }
+                    }
+                    X.row(pivot.second) = x / Aeq_base(row, pivot.second);
+                }
+                Z = X.leftCols(offset_free).sparseView();
+                particular_map = X.rightCols(2 * phi);
             }
-        }
 
-        Eigen::MatrixXd build_Q_p(int qi, int m) {
-            return Q_base * pow(planResult_ptr->T[m+1] - planResult_ptr->T[m], -2 * phi + 1);
+            Eigen::SparseMatrix<double> Z_col = Z;
+            Q_free = Z_col.transpose() * Q_quad * Z_col;
+            c_free = 2 * (Z_col.transpose() * (Q_quad * particular_map));
+            if (condensed) {
+                // Move the particular solution to the minimum of the cost, then Z'QR = 0 and z has no linear cost.
+                // Otherwise the linear cost of z nearly cancels its quadratic cost, and the relative tolerance of
+                // the QP solver stops far from the optimum.
+                Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt(Q_free);
+                if (ldlt.info() == Eigen::Success) {
+                    particular_map -= Z_col * ldlt.solve(0.5 * c_free);
+                    c_free = 2 * (Z_col.transpose() * (Q_quad * particular_map));
+                }
+            }
+            particular = Eigen::MatrixXd::Zero(N * offset_quad, outdim);
+            particular_cost = Eigen::MatrixXd::Zero(N, outdim);
+            if (condensed) {
+                for (int qi = 0; qi < N; qi++) {
+                    particular.block(qi * offset_quad, 0, offset_quad, outdim) =
+                            particular_map * deq.block(qi * 2 * phi, 0, 2 * phi, outdim);
+                    for (int k = 0; k < outdim; k++) {
+                        Eigen::VectorXd xp = particular.block(qi * offset_quad, k, offset_quad, 1);
+                        particular_cost(qi, k) = xp.dot(Q_quad * xp);
+                    }
+                }
+            }
         }
 
         void build_Aeq_base() {
             Aeq_base = Eigen::MatrixXd::Zero((2 * phi + (M - 1) * phi), M * (n + 1));
             Eigen::MatrixXd A_waypoints = Eigen::MatrixXd::Zero(2 * phi, M * (n + 1));
             Eigen::MatrixXd A_cont = Eigen::MatrixXd::Zero((M - 1) * phi, M * (n + 1));
-            Eigen::MatrixXd A_0 = Eigen::MatrixXd::Zero(n + 1, n + 1);
-            Eigen::MatrixXd A_T = Eigen::MatrixXd::Zero(n + 1, n + 1);
-
-            // Build A_0, A_T
-            if (phi == 3 && n == 5) {
-                A_0 << 1, 0, 0, 0, 0, 0,
-                        -1, 1, 0, 0, 0, 0,
-                        1, -2, 1, 0, 0, 0,
-                        -1, 3, -3, 1, 0, 0,
-                        1, -4, 6, -4, 1, 0,
-                        -1, 5, -10, 10, -5, 1;
-
-                A_T << 0, 0, 0, 0, 0, 1,
-                        0, 0, 0, 0, -1, 1,
-                        0, 0, 0, 1, -2, 1,
-                        0, 0, -1, 3, -3, 1,
-                        0, 1, -4, 6, -4, 1,
-                        -1, 5, -10, 10, -5, 1;
-            } else {
-                ROS_ERROR("RBPPlanner: n should be 5"); //TODO: debug when n is not 5
-            }
+            const Eigen::MatrixXd &A_0 = bernstein_basis->getStartDerivatives();
+            const Eigen::MatrixXd &A_T = bernstein_basis->getEndDerivatives();
 
             // Build A_waypoints
             int nn = 1;
@@ -404,46 +647,26 @@ namespace SwarmPlanning {
 
         }
 
-        // Equality constraints condition vector deq
+        // Equality constraints condition vector deq, only the start and goal conditions are stored
+        // since the continuity constraints are homogeneous
         void build_deq() {
-//        deq_obj.reset(new Eigen::MatrixXd(N * (2*n + (M-1)*n), outdim));
-//        deq_obj->setZero();
-            deq = Eigen::MatrixXd::Zero(N * (2 * phi + (M - 1) * phi), outdim);
+            deq = Eigen::MatrixXd::Zero(N * 2 * phi, outdim);
             for (int qi = 0; qi < N; qi++) {
-                Eigen::MatrixXd d_waypoints = Eigen::MatrixXd::Zero(2 * phi, outdim);
-                Eigen::MatrixXd d_cont = Eigen::MatrixXd::Zero((M - 1) * phi, outdim);
                 for (int k = 0; k < outdim; k++) {
-                    d_waypoints(0, k) = mission.startState[qi][k];
-                    d_waypoints(1, k) = mission.startState[qi][k + 3];
-                    d_waypoints(2, k) = mission.startState[qi][k + 6];
-                    d_waypoints(phi, k) = mission.goalState[qi][k];
-                    d_waypoints(phi + 1, k) = mission.goalState[qi][k + 3];
-                    d_waypoints(phi + 2, k) = mission.goalState[qi][k + 6];
-                }
-
-                // Build deq
-                int deq_p_rows = d_waypoints.rows() + d_cont.rows();
-                int deq_p_cols = outdim;
-//            deq_obj->block(qi * deq_p_rows, 0, deq_p_rows, deq_p_cols) << d_waypoints,
-//                                                                          d_cont;
-                deq.block(qi * deq_p_rows, 0, deq_p_rows, deq_p_cols) << d_waypoints,
-                        d_cont;
+                    // position, velocity and acceleration
+                    for (int i = 0; i < std::min(phi, 3); i++) {
+                        deq(qi * 2 * phi + i, k) = mission.startState[qi][k + 3 * i];
+                        deq(qi * 2 * phi + phi + i, k) = mission.goalState[qi][k + 3 * i];
+                    }
+                }
             }
         }
 
-        // Inequality constraints condition vector dlq
+        // Inequality constraints, the SFC and RSFC are the same for all control points of a segment,
+        // so only the box of each agent and the corridor of each pair are stored per segment
         void build_dlq() {
-//        dlq_obj.reset(new Eigen::MatrixXd(N*2*(n+1)*M + N*(N-1)*(n+1)*M, outdim));
-//        dlq_obj->setZero();
-            dlq = Eigen::MatrixXd::Zero(N * 2 * (n + 1) * M + N * (N - 1) * (n + 1) * M, outdim);
-            Eigen::MatrixXd dlq_rel = Eigen::MatrixXd::Zero(N * (N - 1) * (n + 1) * M, outdim);
-            Eigen::MatrixXd dlq_box = Eigen::MatrixXd::Zero(N * 2 * (n + 1) * M, outdim);
-
-            // Build dlq_box
+            box_index.resize(N * M);
             for (int qi = 0; qi < N; qi++) {
-                Eigen::MatrixXd d_upper = Eigen::MatrixXd::Zero((n + 1) * M, outdim);
-                Eigen::MatrixXd d_lower = Eigen::MatrixXd::Zero((n + 1) * M, outdim);
-
                 int bi = 0;
                 for (int m = 0; m < M; m++) {
                     // find box number
@@ -451,63 +674,23 @@ namespace SwarmPlanning {
                            planResult_ptr->SFC[qi][bi].second < planResult_ptr->T[m + 1]) {
                         bi++;
                     }
-
-                    d_upper.block((n + 1) * m, 0, n + 1, 1) =
-                            Eigen::MatrixXd::Constant(n + 1, 1, planResult_ptr->SFC[qi][bi].first[3]);
-                    d_lower.block((n + 1) * m, 0, n + 1, 1) =
-                            Eigen::MatrixXd::Constant(n + 1, 1, -planResult_ptr->SFC[qi][bi].first[0]);
-
-                    d_upper.block((n + 1) * m, 1, n + 1, 1) =
-                            Eigen::MatrixXd::Constant(n + 1, 1, planResult_ptr->SFC[qi][bi].first[4]);
-                    d_lower.block((n + 1) * m, 1, n + 1, 1) =
-                            Eigen::MatrixXd::Constant(n + 1, 1, -planResult_ptr->SFC[qi][bi].first[1]);
-
-                    d_upper.block((n + 1) * m, 2, n + 1, 1) =
-                            Eigen::MatrixXd::Constant(n + 1, 1, planResult_ptr->SFC[qi][bi].first[5]);
-                    d_lower.block((n + 1) * m, 2, n + 1, 1) =
-                            Eigen::MatrixXd::Constant(n + 1, 1, -planResult_ptr->SFC[qi][bi].first[2]);
+                    box_index[qi * M + m] = bi;
                 }
-
-                int dlq_box_rows = d_upper.rows() + d_lower.rows();
-                dlq_box.block(qi * dlq_box_rows, 0, dlq_box_rows, outdim) << d_upper,
-                        d_lower;
             }
 
-            // Build dlq_rel
-            int iter = 0;
-            for (int qi = 0; qi < N; qi++) {
-                for (int qj = qi + 1; qj < N; qj++) {
-                    Eigen::MatrixXd d_upper = Eigen::MatrixXd::Constant((n + 1) * M, outdim, 10000000);
-                    Eigen::MatrixXd d_lower = Eigen::MatrixXd::Constant((n + 1) * M, outdim, 10000000);
-
-                    for (int m = 0; m < M; m++) {
-                        // Find box number
-                        int ri = 0;
-                        while (ri < planResult_ptr->RSFC[qi][qj].size() &&
-                               planResult_ptr->RSFC[qi][qj][ri].second < planResult_ptr->T[m + 1]) {
-                            ri++;
-                        }
-
-                        octomap::point3d normal_vector = planResult_ptr->RSFC[qi][qj][ri].first;
-                        d_upper.block((n + 1) * m, 0, n + 1, 1) =
-                                Eigen::MatrixXd::Constant(n + 1, 1, normal_vector.x());
-                        d_upper.block((n + 1) * m, 1, n + 1, 1) =
-                                Eigen::MatrixXd::Constant(n + 1, 1, normal_vector.y());
-                        d_upper.block((n + 1) * m, 2, n + 1, 1) =
-                                Eigen::MatrixXd::Constant(n + 1, 1, normal_vector.z());
-                    }
-                    int dlq_rel_rows = d_upper.rows() + d_lower.rows();
-                    dlq_rel.block(iter * dlq_rel_rows, 0, dlq_rel_rows, outdim) << d_upper,
-                            d_lower;
-                    iter++;
+            // only the agent pairs that have RSFC
+            int P = planResult_ptr->RSFC.size();
+            rsfc_index.resize(P * M);
+            for (int p = 0; p < P; p++) {
+                for (int m = 0; m < M; m++) {
+                    rsfc_index[p * M + m] = planResult_ptr->RSFC.findCorridor(p, planResult_ptr->T[m + 1]);
                 }
             }
+        }
 
-            // Build dlq
-//        dlq_obj->block(0, 0, dlq_box.rows(), dlq_box.cols()) = dlq_box;
-//        dlq_obj->block(dlq_box.rows(), 0, dlq_rel.rows(), dlq_rel.cols()) = dlq_rel;
-            dlq << dlq_box,
-                    dlq_rel;
+        // Normal vector of the RSFC of pair p in the m-th segment, zero if it is redundant
+        const octomap::point3d &getRSFCNormal(int p, int m) const {
+            return planResult_ptr->RSFC.normal[rsfc_index[p * M + m]];
         }
 
         void build_dummy() {
@@ -548,336 +731,454 @@ namespace SwarmPlanning {
             }
         }
 
-        void populatebyrow(IloModel model, IloNumVarArray x, IloRangeArray c, int l) {
-            int offset_dim = batches[l].size() * M * (n + 1);
-            IloEnv env = model.getEnv();
+        // Assemble the QP of batch l directly in sparse form.
+        // x[k * offset_dim + bi * offset_free + f] is the f-th variable z of the bi-th agent in the batch along the
+        // k-th axis, see Z. If not condensed, f = m * (n + 1) + i is the i-th control point of the m-th segment.
+        // The box SFC is expressed as variable bounds where the control point is a shifted variable.
+        void buildQP(int l, QPProblem *qp) {
+            int offset_dim = batches[l].size() * offset_free;
+            int cols = outdim * offset_dim;
+
+            // Cost function, block diagonal with one Q_free block per agent and axis
+            std::vector<Eigen::Triplet<double>> Q_triplets;
+            Q_triplets.reserve(outdim * batches[l].size() * Q_free.nonZeros());
+            qp->c = condensed ? Eigen::VectorXd::Zero(cols) : Eigen::VectorXd();
+            batch_cost_const[l] = 0;
             for (int k = 0; k < outdim; k++) {
                 for (int bi = 0; bi < batches[l].size(); bi++) {
-                    for (int m = 0; m < M; m++) {
-                        for (int i = 0; i < n + 1; i++) {
-                            x.add(IloNumVar(env, -IloInfinity, IloInfinity));
+                    int qi = batches[l][bi];
+                    int offset = k * offset_dim + bi * offset_free;
+                    for (int j = 0; j < Q_free.outerSize(); j++) {
+                        for (Eigen::SparseMatrix<double>::InnerIterator it(Q_free, j); it; ++it) {
+                            Q_triplets.emplace_back(Eigen::Triplet<double>(offset + it.row(), offset + it.col(),
+                                                                           it.value()));
+                        }
+                    }
+                    if (condensed) {
+                        qp->c.segment(offset, offset_free) = c_free * deq.block(qi * 2 * phi, k, 2 * phi, 1);
+                        batch_cost_const[l] += particular_cost(qi, k);
+                    }
+                }
+            }
+            qp->Q.resize(cols, cols);
+            qp->Q.setFromTriplets(Q_triplets.begin(), Q_triplets.end());
+            qp->Q.makeCompressed();
 
-                            int qi = batches[l][bi];
-                            int row = k * offset_dim + bi * offset_quad + m * (n + 1) + i;
-                            std::string name;
-                            if (k == 0) {
-                                name = "x_" + std::to_string(qi) + "_" + std::to_string(m) + "_" + std::to_string(i);
-                            } else if (k == 1) {
-                                name = "y_" + std::to_string(qi) + "_" + std::to_string(m) + "_" + std::to_string(i);
-                            } else if (k == 2) {
-                                name = "z_" + std::to_string(qi) + "_" + std::to_string(m) + "_" + std::to_string(i);
-                            } else {
-                                ROS_ERROR("RBPPlanner: Invalid outdim");
-                            }
+            QPRowBuilder rows(cols);
+            std::vector<int> row_cols;
+            std::vector<double> row_vals;
 
-                            x[row].setName(name.c_str());
+            // Equality Constraints, they are eliminated by condensing
+            for (int k = 0; k < outdim && !condensed; k++) {
+                for (int bi = 0; bi < batches[l].size(); bi++) {
+                    int qi = batches[l][bi];
+                    for (int i = 0; i < Aeq_base_sparse.rows(); i++) {
+                        row_cols.clear();
+                        row_vals.clear();
+                        for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(Aeq_base_sparse, i); it; ++it) {
+                            row_cols.emplace_back(k * offset_dim + bi * offset_free + it.col());
+                            row_vals.emplace_back(it.value());
                         }
+                        double d = i < 2 * phi ? deq(qi * 2 * phi + i, k) : 0;
+                        rows.addRow(row_cols, row_vals, d, d);
                     }
                 }
             }
-            count_x = x.getSize();
+            qp->num_eq = rows.rows();
 
-            // Cost function
-            IloNumExpr cost(env);
-            for (int k = 0; k < outdim; k++) {
-                for (int bi = 0; bi < batches[l].size(); bi++) {
-                    for (int m = 0; m < M; m++) {
+            // Inequality Constraints
+            qp->col_lower = Eigen::VectorXd::Constant(cols, -QP_INFINITY);
+            qp->col_upper = Eigen::VectorXd::Constant(cols, QP_INFINITY);
+            if (planResult_ptr->SFC_poly.empty()) {
+                for (int k = 0; k < outdim; k++) {
+                    for (int bi = 0; bi < batches[l].size(); bi++) {
                         int qi = batches[l][bi];
-                        Eigen::MatrixXd Q_p = build_Q_p(qi, m);
-
-                        for (int i = 0; i < n + 1; i++) {
-                            int row = qi * M * (n + 1) + m * (n + 1) + i;
-                            int row_idx = k * offset_dim + bi * offset_quad + m * (n + 1) + i;
-
-                            for (int j = 0; j < n + 1; j++) {
-                                int col = qi * M * (n + 1) + m * (n + 1) + j;
-                                int col_idx =
-                                        k * offset_dim + bi * offset_quad + m * (n + 1) + j;
-
-                                if (Q_p(i, j) != 0) {
-                                    cost += Q_p(i, j) * x[row_idx] * x[col_idx];
+                        int offset = k * offset_dim + bi * offset_free;
+                        for (int m = 0; m < M; m++) {
+                            const std::vector<double> &box = planResult_ptr->SFC[qi][box_index[qi * M + m]].first;
+                            for (int j = m * (n + 1); j < (m + 1) * (n + 1); j++) {
+                                if (free_index[j] >= 0) {
+                                    double xp = particular(qi * offset_quad + j, k);
+                                    qp->col_lower(offset + free_index[j]) = box[k] - xp;
+                                    qp->col_upper(offset + free_index[j]) = box[k + 3] - xp;
+                                } else {
+                                    row_cols.clear();
+                                    row_vals.clear();
+                                    double xp = addCtrlTerms(offset, qi, j, k, 1, &row_cols, &row_vals);
+                                    rows.addRow(row_cols, row_vals, box[k] - xp, box[k + 3] - xp);
                                 }
                             }
                         }
                     }
                 }
-            }
-            model.add(IloMinimize(env, cost));
-
-            // Equality Constraints
-            for (int k = 0; k < outdim; k++) {
+            } else {
+                // Convex polytope SFC, a * x <= b for all control points of the segment
                 for (int bi = 0; bi < batches[l].size(); bi++) {
-                    for (int i = 0; i < 2 * phi + (M - 1) * phi; i++) {
-                        IloNumExpr expr(env);
-                        for (int j = 0; j < M * (n + 1); j++) {
-                            if (Aeq_base(i, j) != 0) {
-                                expr += Aeq_base(i, j) * x[k * offset_dim + bi * offset_quad + j];
+                    int qi = batches[l][bi];
+                    int pi = 0;
+                    for (int m = 0; m < M; m++) {
+                        // find polytope number
+                        while (pi < planResult_ptr->SFC_poly[qi].size() &&
+                               planResult_ptr->SFC_poly[qi][pi].second < planResult_ptr->T[m + 1]) {
+                            pi++;
+                        }
+
+                        for (const auto &halfspace : planResult_ptr->SFC_poly[qi][pi].first) {
+                            for (int j = m * (n + 1); j < (m + 1) * (n + 1); j++) {
+                                row_cols.clear();
+                                row_vals.clear();
+                                double xp = 0;
+                                for (int k = 0; k < outdim; k++) {
+                                    xp += addCtrlTerms(k * offset_dim + bi * offset_free, qi, j, k,
+                                                       halfspace.first(k), &row_cols, &row_vals);
+                                }
+                                rows.addRow(row_cols, row_vals, -QP_INFINITY, halfspace.second - xp);
                             }
                         }
-                        int qi = batches[l][bi];
-                        c.add(expr == deq(qi * (2 * phi + (M - 1) * phi) + i, k));
-                        expr.end();
                     }
                 }
             }
-            count_eq = c.getSize();
 
-            // Inequality Constraints
-            for (int k = 0; k < outdim; k++) {
-                for (int bi = 0; bi < batches[l].size(); bi++) {
-                    int qi = batches[l][bi];
-                    for (int j = 0; j < (n + 1) * M; j++) {
-                        int idx = k * offset_dim + bi * offset_quad + j;
-                        c.add(x[idx] <= dlq(2 * qi * offset_quad + j, k));
-                        c.add(-x[idx] <= dlq((2 * qi + 1) * offset_quad + j, k));
-                    }
+            // RSFC, normal * (x_j - x_i) >= r_i + r_j. Agents out of the batch are fixed to dummy.
+            dummy_rows[l].clear();
+            for (int p = 0; p < planResult_ptr->RSFC.size(); p++) {
+                int qi = planResult_ptr->RSFC.pairs[p].first;
+                int qj = planResult_ptr->RSFC.pairs[p].second;
+                int bi = isQuadInBatch(qi, l);
+                int bj = isQuadInBatch(qj, l);
+                if (bi < 0 && bj < 0) {
+                    continue;
                 }
-            }
-            int offset_box = 2 * N * offset_quad;
-            int iter = 0;
-            for (int qi = 0; qi < N; qi++) {
-                for (int qj = qi + 1; qj < N; qj++) {
-                    int bi = isQuadInBatch(qi, l);
-                    int bj = isQuadInBatch(qj, l);
-
-                    if (bi < 0 && bj < 0) {
-
-                    } else if (bi >= 0 && bj < 0) {
-                        for (int j = 0; j < M * (n + 1); j++) {
-                            int idx = bi * offset_quad + j;
-                            c.add(dlq(offset_box + offset_quad * 2 * iter + j, 0) *
-                                  (dummy(qj * offset_quad + j, 0) - x[0 * offset_dim + idx]) +
-                                  dlq(offset_box + offset_quad * 2 * iter + j, 1) *
-                                  (dummy(qj * offset_quad + j, 1) - x[1 * offset_dim + idx]) +
-                                  dlq(offset_box + offset_quad * 2 * iter + j, 2) *
-                                  (dummy(qj * offset_quad + j, 2) - x[2 * offset_dim + idx])
-                                  >= mission.quad_size[qi] + mission.quad_size[qj]);
-                        }
-                    } else if (bi < 0 && bj >= 0) {
-                        for (int j = 0; j < M * (n + 1); j++) {
-                            int jdx = bj * offset_quad + j;
-                            c.add(dlq(offset_box + offset_quad * 2 * iter + j, 0) *
-                                  (x[0 * offset_dim + jdx] - dummy(qi * offset_quad + j, 0)) +
-                                  dlq(offset_box + offset_quad * 2 * iter + j, 1) *
-                                  (x[1 * offset_dim + jdx] - dummy(qi * offset_quad + j, 1)) +
-                                  dlq(offset_box + offset_quad * 2 * iter + j, 2) *
-                                  (x[2 * offset_dim + jdx] - dummy(qi * offset_quad + j, 2))
-                                  >= mission.quad_size[qi] + mission.quad_size[qj]);
+
+                for (int j = 0; j < M * (n + 1); j++) {
+                    // Redundant segment
+                    const octomap::point3d &normal = getRSFCNormal(p, j / (n + 1));
+                    if (normal.x() == 0 && normal.y() == 0 && normal.z() == 0) {
+                        continue;
+                    }
+                    row_cols.clear();
+                    row_vals.clear();
+                    for (int k = 0; k < outdim; k++) {
+                        double a = normal(k);
+                        if (bj >= 0) {
+                            addCtrlTerms(k * offset_dim + bj * offset_free, qj, j, k, a, &row_cols, &row_vals);
                         }
-                    } else {
-                        for (int j = 0; j < M * (n + 1); j++) {
-                            int idx = bi * offset_quad + j;
-                            int jdx = bj * offset_quad + j;
-
-                            c.add(dlq(offset_box + offset_quad * 2 * iter + j, 0) *
-                                  (x[0 * offset_dim + jdx] - x[0 * offset_dim + idx]) +
-                                  dlq(offset_box + offset_quad * 2 * iter + j, 1) *
-                                  (x[1 * offset_dim + jdx] - x[1 * offset_dim + idx]) +
-                                  dlq(offset_box + offset_quad * 2 * iter + j, 2) *
-                                  (x[2 * offset_dim + jdx] - x[2 * offset_dim + idx])
-                                  >= mission.quad_size[qi] + mission.quad_size[qj]);
+                        if (bi >= 0) {
+                            addCtrlTerms(k * offset_dim + bi * offset_free, qi, j, k, -a, &row_cols, &row_vals);
                         }
                     }
-
-                    iter++;
+                    int row = rows.addRow(row_cols, row_vals, getRSFCLowerBound(l, p, j), QP_INFINITY);
+                    if (bi < 0 || bj < 0) {
+                        dummy_rows[l].push_back({row, p, j});
+                    }
                 }
             }
-            model.add(c);
-
-            count_lq = c.getSize() - count_eq;
+            rows.build(qp);
         }
 
-        // timeMatrix is mapping matrix (n + 1) x (n + 1)
-        // e.g. [1   0   0   ...]
-        //      [0   t   0   ...]
-        //      [0   0   t^2 ...]
-        //      [... ... ... ...]
-        void timeMatrix(double t, Eigen::MatrixXd* tm_ptr) {
-            *tm_ptr = Eigen::MatrixXd::Zero(n + 1, n + 1);
-            for (int i = 0; i < n + 1; i++) {
-                (*tm_ptr)(i, i) = pow(t, n - i);
+        // Append a * x to the row, where x is the j-th control point of qi along the k-th axis and the QP variables
+        // of qi along the axis start at offset. Returns a times the particular part of x, which goes to the bounds.
+        double addCtrlTerms(int offset, int qi, int j, int k, double a,
+                            std::vector<int> *row_cols, std::vector<double> *row_vals) {
+            for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(Z, j); it; ++it) {
+                row_cols->emplace_back(offset + it.col());
+                row_vals->emplace_back(a * it.value());
             }
+            return a * particular(qi * offset_quad + j, k);
         }
 
-        // Get derivative of m^th segment(polynomial) of qi^th agent
-        // e.g. if phi = 3, n = 5, polynomial [1 1 1 1 1 1] then
-        //      coef_der = [1  1  1  1  1  1]
-        //                 [5  4  3  2  1  0]
-        //                 [20 12 6  2  0  0]
-        //                 [60 24 6  0  0  0]
-        void derivative_segment(int qi, int k, int m, Eigen::MatrixXd* coef_der_ptr) {
-            *coef_der_ptr = Eigen::MatrixXd::Zero(phi + 1, n + 1);
-            for (int i = 0; i < phi + 1; i++) {
-                for (int j = 0; j < n + 1; j++) {
-                    if (i <= j)
-                        (*coef_der_ptr)(i, n - j) = coef_derivative(i, j) * coef[qi](m * offset_seg + n - j, k);
-                    else
-                        (*coef_der_ptr)(i, n - j) = 0;
+        // Lower bound of the RSFC row of pair p at the j-th control point in batch l,
+        // the agents out of the batch are moved to the right-hand side with their dummy trajectories,
+        // and the agents in the batch with their particular solutions
+        double getRSFCLowerBound(int l, int p, int j) {
+            int qi = planResult_ptr->RSFC.pairs[p].first;
+            int qj = planResult_ptr->RSFC.pairs[p].second;
+            const octomap::point3d &normal = getRSFCNormal(p, j / (n + 1));
+            double lower = mission.quad_size[qi] + mission.quad_size[qj];
+            for (int k = 0; k < outdim; k++) {
+                double a = normal(k);
+                if (isQuadInBatch(qj, l) < 0) {
+                    lower -= a * dummy(qj * offset_quad + j, k);
+                } else {
+                    lower -= a * particular(qj * offset_quad + j, k);
+                }
+                if (isQuadInBatch(qi, l) < 0) {
+                    lower += a * dummy(qi * offset_quad + j, k);
+                } else {
+                    lower += a * particular(qi * offset_quad + j, k);
                 }
             }
+            return lower;
         }
 
-        // Get j^th coefficient of i^th derivative of polynomial [1 1 1 1 ... 1]
-        int coef_derivative(int i, int j) {
-            return (i == 0) ? 1 : coef_derivative(i - 1, j - 1) * j;
-        }
-
-        // Get roots of i^th derivative of polynomial with coefficient coef
-        // The roots of the polynomial are calculated by computing the eigenvalues of the companion matrix, A
-        std::vector<double> roots_derivative(int i, const Eigen::MatrixXd& coef_der) {
-            std::vector<double> roots_der;
-            int n_der = n - i;
-            int iter = 0;
-            while(n_der > 0 && coef_der(i, n - i - n_der) == 0 ){
-                n_der--;
-            }
-            if(n_der == 0){
-                return roots_der; // return empty vector
+        // Time scale of each segment of qi from the Bernstein control points of the derivatives,
+        // velocity n (c[i+1] - c[i]) / dt and acceleration n (n - 1) (c[i+2] - 2 c[i+1] + c[i]) / dt^2.
+        // Their hulls bound all segments at once, and only the segments whose hull exceeds the given scale
+        // are refined by bernstein::maxAbs. scales holds the lower bounds of the scales on entry.
+        void getSegmentScales(int qi, std::vector<double> *scales) {
+            const double tol = 1e-6;
+            Eigen::ArrayXd inv_dt(M);
+            for (int m = 0; m < M; m++) {
+                inv_dt(m) = 1.0 / (planResult_ptr->T[m + 1] - planResult_ptr->T[m]);
             }
 
-            Eigen::MatrixXd A = Eigen::MatrixXd::Zero(n_der, n_der);
-            for (int j = 0; j < n_der; j++) {
-                if (j < n_der - 1) {
-                    A(j + 1, j) = 1;
+            for (int k = 0; k < outdim; k++) {
+                // control points of the m-th segment in column m
+                Eigen::Map<const Eigen::MatrixXd> ctrl(ctrl_points[qi].col(k).data(), n + 1, M);
+
+                // velocity, normalized by max_vel
+                Eigen::ArrayXXd vel = (ctrl.bottomRows(n) - ctrl.topRows(n)).array().rowwise()
+                                      * (inv_dt * n / mission.max_vel[qi][k]).transpose();
+                Eigen::ArrayXd vel_hull = vel.abs().colwise().maxCoeff().transpose();
+                for (int m = 0; m < M; m++) {
+                    double &scale = (*scales)[m];
+                    if (vel_hull(m) > scale) {
+                        scale = bernstein::maxAbs(vel.col(m).data(), n - 1, scale, tol);
+                    }
                 }
-                A(0, j) = -coef_der(i, n - i - n_der + j + 1) / coef_der(i, n - i - n_der);
-            }
 
-            Eigen::EigenSolver<Eigen::MatrixXd> es(A);
-            for (int j = 0; j < i; j++) {
-                complex<double> lambda = es.eigenvalues()[j];
-                if (lambda.imag() == 0) {
-                    roots_der.emplace_back(lambda.real());
+                // acceleration, normalized by max_acc
+                if (n < 2) {
+                    continue;
+                }
+                Eigen::ArrayXXd acc = (ctrl.bottomRows(n - 1) - 2 * ctrl.middleRows(1, n - 1)
+                                       + ctrl.topRows(n - 1)).array().rowwise()
+                                      * (inv_dt.square() * n * (n - 1) / mission.max_acc[qi][k]).transpose();
+                Eigen::ArrayXd acc_hull = acc.abs().colwise().maxCoeff().transpose();
+                for (int m = 0; m < M; m++) {
+                    double &scale = (*scales)[m];
+                    if (acc_hull(m) > scale * scale) {
+                        scale = sqrt(bernstein::maxAbs(acc.col(m).data(), n - 2, scale * scale, tol));
+                    }
                 }
             }
-            return roots_der;
         }
 
-        double scale_to_max_vel(int qi, int k, int m, const Eigen::MatrixXd& coef_der) {
-            assert(phi > 1);
-            double scale_update_rate = 1.1; //TODO: parameterization?
-
-            // Get maximum velocity
-            double vel_max = 0, t_max = 0;
-            std::vector<double> ts = roots_derivative(2, coef_der);
-            ts.emplace_back(0);
-            ts.emplace_back(planResult_ptr->T[m + 1] - planResult_ptr->T[m]);
-            for (auto t : ts) {
-                if (t < 0 || t > planResult_ptr->T[m + 1] - planResult_ptr->T[m]) {
-                    continue;
+        void setBatch(int alg){
+            int batch_max_iter = ceil((double)N / (double)param.batch_size);
+            if (param.sequential) {
+                if (param.batch_iter < 0 || param.batch_iter > batch_max_iter) {
+                    param.batch_iter = batch_max_iter;
                 }
+            } else {
+                param.batch_size = N;
+                param.batch_iter = 1;
+                batch_max_iter = 1;
+            }
 
-                double vel = 0;
-                for (int i = 0; i <= (n - 1); i++) {
-                    vel += coef_der(1, i) * pow(t, n - 1 - i);
+            batches.clear();
+            if (alg == SP_BATCH_GREEDY && batch_max_iter > 1) {
+                setBatchGreedy(buildInteractionGraph());
+            } else if (alg == SP_BATCH_SPECTRAL && batch_max_iter > 1) {
+                setBatchSpectral(buildInteractionGraph(), batch_max_iter);
+            } else {
+                if (alg != SP_BATCH_INDEX && alg != SP_BATCH_GREEDY && alg != SP_BATCH_SPECTRAL) {
+                    ROS_ERROR("RBPPlaner: invalid batch algorithm, use index");
                 }
-                vel = abs(vel);
-                if (vel_max < vel) {
-                    vel_max = vel;
-                    t_max = t;
+                //default groups
+                batches.resize(batch_max_iter);
+                for (int qi = 0; qi < N; qi++) {
+                    batches[qi / param.batch_size].emplace_back(qi);
                 }
             }
 
-            // time_scale update
-            double time_scale = 1;
-            while (vel_max > mission.max_vel[qi][k]) {
-                time_scale *= scale_update_rate;
-
-                double vel = 0;
-                for (int i = 0; i <= (n - 1); i++) {
-                    vel += coef_der(1, i) * pow(1 / time_scale, n - i) * pow(t_max, n - 1 - i);
+            batch_of.assign(N, -1);
+            batch_slot.assign(N, -1);
+            for (int l = 0; l < batches.size(); l++) {
+                for (int bi = 0; bi < batches[l].size(); bi++) {
+                    batch_of[batches[l][bi]] = l;
+                    batch_slot[batches[l][bi]] = bi;
                 }
-                vel_max = abs(vel);
             }
-
-            return time_scale;
         }
 
+        // Interaction graph of the agents, the weight of an edge is the duration of the active RSFC of the pair
+        Eigen::MatrixXd buildInteractionGraph() {
+            const RSFC_t &RSFC = planResult_ptr->RSFC;
+            Eigen::MatrixXd W = Eigen::MatrixXd::Zero(N, N);
+            for (int p = 0; p < RSFC.size(); p++) {
+                double weight = 0;
+                double t_prev = planResult_ptr->T.front();
+                for (int ri = RSFC.offset[p]; ri < RSFC.offset[p + 1]; ri++) {
+                    double t = std::min(RSFC.time[ri], planResult_ptr->T.back());
+                    if (RSFC.normal[ri].norm() > SP_EPSILON) {
+                        weight += std::max(t - t_prev, 0.0);
+                    }
+                    t_prev = t;
+                }
+                W(RSFC.pairs[p].first, RSFC.pairs[p].second) = weight;
+                W(RSFC.pairs[p].second, RSFC.pairs[p].first) = weight;
+            }
+            return W;
+        }
 
-        double scale_to_max_acc(int qi, int k, int m, const Eigen::MatrixXd &coef_der) {
-            assert(phi == 3 && n == 5);
-            double scale_update_rate = 1.1; //TODO: parameterization?
-
-            // Get maximum accelaration
-            double a, b, c, D, acc_max, t_max = 0;
-            a = coef_der(3, 0);
-            b = coef_der(3, 1);
-            c = coef_der(3, 2);
-            D = b * b - 4 * a * c;
-            acc_max = 0;
+        // Grow each batch from the agent with the strongest interaction among the remaining agents,
+        // then add the agent with the strongest interaction to the batch until it is full
+        void setBatchGreedy(const Eigen::MatrixXd &W) {
+            std::vector<char> assigned(N, false);
+            Eigen::VectorXd remain_weight = W.rowwise().sum();
+            for (int remain = N; remain > 0;) {
+                std::vector<int> batch;
+                Eigen::VectorXd batch_weight = Eigen::VectorXd::Zero(N);
+                while (batch.size() < param.batch_size && remain > 0) {
+                    int best = -1;
+                    for (int qi = 0; qi < N; qi++) {
+                        if (assigned[qi]) {
+                            continue;
+                        }
+                        if (best < 0 || batch_weight(qi) > batch_weight(best) ||
+                            (batch_weight(qi) == batch_weight(best) && remain_weight(qi) > remain_weight(best))) {
+                            best = qi;
+                        }
+                    }
+                    assigned[best] = true;
+                    remain--;
+                    batch.emplace_back(best);
+                    batch_weight += W.col(best);
+                    remain_weight -= W.col(best);
+                }
+                std::sort(batch.begin(), batch.end());
+                batches.emplace_back(batch);
+            }
+        }
 
-            std::vector<double> ts{0, planResult_ptr->T[m+1] - planResult_ptr->T[m]};
-            if (D >= 0 && a != 0) {
-                ts.emplace_back((-b + sqrt(D)) / (2 * a));
-                ts.emplace_back((-b - sqrt(D)) / (2 * a));
+        // Spectral grouping. The agents that do not interact are in different connected components of the interaction
+        // graph, so the graph is split into its components and only the components larger than batch_size are
+        // bisected. The parts are packed into num_batches batches, and a part is split only if it fits in no batch.
+        void setBatchSpectral(const Eigen::MatrixXd &W, int num_batches) {
+            std::vector<int> agents(N);
+            for (int qi = 0; qi < N; qi++) {
+                agents[qi] = qi;
             }
-            else if(a == 0 && b != 0){
-                ts.emplace_back(-c/b);
+            std::vector<std::vector<int>> parts;
+            bisectSpectral(W, agents, &parts);
+
+            // First fit decreasing
+            std::stable_sort(parts.begin(), parts.end(), [](const std::vector<int> &a, const std::vector<int> &b) {
+                return a.size() > b.size();
+            });
+            for (const auto &part : parts) {
+                auto batch = std::find_if(batches.begin(), batches.end(), [&](const std::vector<int> &batch) {
+                    return batch.size() + part.size() <= param.batch_size;
+                });
+                if (batch != batches.end()) {
+                    batch->insert(batch->end(), part.begin(), part.end());
+                } else if (batches.size() < num_batches) {
+                    batches.emplace_back(part);
+                } else {
+                    int i = 0;
+                    for (auto &batch_split : batches) {
+                        while (i < part.size() && batch_split.size() < param.batch_size) {
+                            batch_split.emplace_back(part[i++]);
+                        }
+                    }
+                }
+            }
+            for (auto &batch : batches) {
+                std::sort(batch.begin(), batch.end());
             }
+        }
 
-            for (auto t : ts) {
-                if (t < 0 || t > planResult_ptr->T[m+1] - planResult_ptr->T[m]) {
+        // Recursive spectral bisection into parts of at most batch_size agents. The agents of a connected component
+        // are ordered by the Fiedler vector of its Laplacian and split so that every part but the last is full.
+        void bisectSpectral(const Eigen::MatrixXd &W, const std::vector<int> &agents,
+                            std::vector<std::vector<int>> *parts) {
+            int size = agents.size();
+            if (size <= param.batch_size) {
+                parts->emplace_back(agents);
+                return;
+            }
+
+            // Connected components, the Fiedler vector of a disconnected graph is an arbitrary vector
+            // in the nullspace of the Laplacian
+            std::vector<int> component(size, -1);
+            int num_components = 0;
+            for (int root = 0; root < size; root++) {
+                if (component[root] >= 0) {
                     continue;
                 }
-
-                double acc = 0;
-                for (int i = 0; i < 4; i++) {
-                    acc += coef_der(2, i) * pow(t, 3 - i);
+                std::vector<int> stack{root};
+                component[root] = num_components;
+                while (!stack.empty()) {
+                    int i = stack.back();
+                    stack.pop_back();
+                    for (int j = 0; j < size; j++) {
+                        if (component[j] < 0 && W(agents[i], agents[j]) > 0) {
+                            component[j] = num_components;
+                            stack.emplace_back(j);
+                        }
+                    }
+                }
+                num_components++;
+            }
+            if (num_components > 1) {
+                std::vector<std::vector<int>> components(num_components);
+                for (int i = 0; i < size; i++) {
+                    components[component[i]].emplace_back(agents[i]);
                 }
-                acc = abs(acc);
-                if (acc_max < acc) {
-                    acc_max = acc;
-                    t_max = t;
+                for (const auto &agents_component : components) {
+                    bisectSpectral(W, agents_component, parts);
                 }
+                return;
             }
 
-            // time_scale update
-            double time_scale = 1;
-            while (acc_max > mission.max_acc[qi][k]) {
-                time_scale *= scale_update_rate;
-
-                double acc = 0;
-                for (int i = 0; i < 4; i++) {
-                    acc += coef_der(2, i) * pow(1 / time_scale, n - i) * pow(t_max, 3 - i);
+            Eigen::MatrixXd L = Eigen::MatrixXd::Zero(size, size);
+            for (int i = 0; i < size; i++) {
+                for (int j = 0; j < size; j++) {
+                    if (i != j) {
+                        L(i, j) = -W(agents[i], agents[j]);
+                        L(i, i) += W(agents[i], agents[j]);
+                    }
                 }
-                acc_max = abs(acc);
             }
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(L);
+            Eigen::VectorXd fiedler = es.eigenvectors().col(1);
+
+            std::vector<int> order(size);
+            for (int i = 0; i < size; i++) {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&](int i, int j) { return fiedler(i) < fiedler(j); });
 
-            return time_scale;
+            int num_parts = (size + param.batch_size - 1) / param.batch_size;
+            int split = (num_parts + 1) / 2 * param.batch_size;
+            std::vector<int> left, right;
+            for (int i = 0; i < size; i++) {
+                (i < split ? left : right).emplace_back(agents[order[i]]);
+            }
+            bisectSpectral(W, left, parts);
+            bisectSpectral(W, right, parts);
         }
 
-        void setBatch(int alg){
-            int batch_max_iter = ceil((double)N / (double)param.batch_size);
-            if (param.sequential) {
-                int batch_max_iter = ceil((double)N / (double)param.batch_size);
-                if (param.batch_iter < 0 || param.batch_iter > batch_max_iter) {
-                    param.batch_iter = batch_max_iter;
+        // Level the batches by their RSFC coupling. Batch l fixes the agents of the coupled batches to dummy, which
+        // holds the solutions of the earlier batches, so it is placed after the coupled earlier batches.
+        // The batches of the same level share no RSFC pair, so solving them concurrently gives the same result
+        // as solving all batches one after another.
+        void setBatchLevels() {
+            std::vector<std::vector<int>> coupled(param.batch_iter);
+            for (const auto &pair : planResult_ptr->RSFC.pairs) {
+                int li = batch_of[pair.first];
+                int lj = batch_of[pair.second];
+                if (li < param.batch_iter && lj < param.batch_iter && li != lj) {
+                    coupled[std::max(li, lj)].emplace_back(std::min(li, lj));
                 }
-            } else {
-                param.batch_size = N;
-                param.batch_iter = 1;
             }
 
-            batches.resize(batch_max_iter);
-
-            //default groups
-            if(alg == 0) {
-                for (int qi = 0; qi < N; qi++) {
-                    batches[qi / param.batch_size].emplace_back(qi);
+            std::vector<int> level(param.batch_iter, 0);
+            batch_levels.clear();
+            for (int l = 0; l < param.batch_iter; l++) {
+                for (int prev : coupled[l]) {
+                    level[l] = std::max(level[l], level[prev] + 1);
                 }
-            }
-            else{
-                ROS_ERROR("RBPPlaner: invalid batch algorithm");
+                if (level[l] >= batch_levels.size()) {
+                    batch_levels.resize(level[l] + 1);
+                }
+                batch_levels[level[l]].emplace_back(l);
             }
         }
 
         int isQuadInBatch(int qi, int l){
-            for(int bi = 0; bi < batches[l].size(); bi++){
-                if(qi == batches[l][bi]){
-                    return bi;
-                }
-            }
-            return -1;
+            return batch_of[qi] == l ? batch_slot[qi] : -1;
         }
     };
 }
\ No newline at end of file
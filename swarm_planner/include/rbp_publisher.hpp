@@ -100,6 +100,24 @@ namespace SwarmPlanning {
 //            update_distance_between_agents_realtime(current_time);
         }
 
+        // Position, velocity and acceleration of each agent at current_time, the end state after the trajectory
+        std::vector<std::vector<double>> getState(double current_time) {
+            current_time = std::min(std::max(current_time, T.front()), T.back());
+            std::vector<std::vector<double>> state(qn, std::vector<double>(9, 0));
+            for (int qi = 0; qi < qn; qi++) {
+                int index = 0;
+                Eigen::MatrixXd polyder;
+                timeMatrix(current_time, index, polyder);
+                Eigen::MatrixXd pva_qi = polyder * coef[qi].block((param.n + 1) * index, 0, (param.n + 1), 3);
+                for (int i = 0; i < 3; i++) {
+                    for (int k = 0; k < 3; k++) {
+                        state[qi][3 * i + k] = pva_qi(i, k);
+                    }
+                }
+            }
+            return state;
+        }
+
         void publish() {
             for (int qi = 0; qi < qn; qi++) {
                 pubs_traj_coef[qi].publish(planResult.msgs_traj_coef[qi]);
@@ -330,16 +348,15 @@ namespace SwarmPlanning {
         }
 
         void update_relBox(double current_time) {
+            // RSFC pairs are sorted by qi, so the pairs of each agent are contiguous
+            int p = 0;
             for (int qi = 0; qi < qn; qi++) {
                 visualization_msgs::MarkerArray mk_array;
-                for (int qj = qi + 1; qj < qn; qj++) {
-                    int box_curr = 0;
-                    while (box_curr < planResult.RSFC[qi][qj].size() &&
-                           planResult.RSFC[qi][qj][box_curr].second < current_time) {
-                        box_curr++;
-                    }
-                    if (box_curr >= planResult.RSFC[qi][qj].size()) {
-                        box_curr = planResult.RSFC[qi][qj].size() - 1;
+                for (; p < planResult.RSFC.size() && planResult.RSFC.pairs[p].first == qi; p++) {
+                    int qj = planResult.RSFC.pairs[p].second;
+                    int box_curr = planResult.RSFC.findCorridor(p, current_time);
+                    if (planResult.RSFC.normal[box_curr].norm() == 0) { // redundant segment
+                        continue;
                     }
 
                     visualization_msgs::Marker mk;
@@ -424,7 +441,7 @@ namespace SwarmPlanning {
                     qi_vector.y() = pva[qi](0, 1);
                     qi_vector.z() = pva[qi](0, 2);
 
-                    octomap::point3d normal_vector = planResult.RSFC[qi][qj][box_curr].first;
+                    octomap::point3d normal_vector = planResult.RSFC.normal[box_curr];
                     Eigen::Vector3d V3d_normal_vector(normal_vector.x(), normal_vector.y(), normal_vector.z());
 
                     double distance = r / normal_vector.norm() + mk.scale.z / 2;
@@ -496,26 +513,21 @@ namespace SwarmPlanning {
 
                     octomap::point3d normal_vector;
                     int box_curr = 0;
-                    if (qi < qj) { // RSFC
-                        while (box_curr < planResult.RSFC[qi][qj].size() &&
-                               planResult.RSFC[qi][qj][box_curr].second < current_time) {
-                            box_curr++;
-                        }
-                        if (box_curr >= planResult.RSFC[qi][qj].size()) {
-                            box_curr = planResult.RSFC[qi][qj].size() - 1;
+                    int p = qi < qj ? planResult.RSFC.findPair(qi, qj) : planResult.RSFC.findPair(qj, qi);
+                    if (qi != qj && p < 0) {
+                        continue;
+                    } else if (qi < qj) { // RSFC
+                        box_curr = planResult.RSFC.findCorridor(p, current_time);
+                        normal_vector = planResult.RSFC.normal[box_curr];
+                        if (normal_vector.norm() == 0) { // redundant segment
+                            continue;
                         }
-
-                        normal_vector = planResult.RSFC[qi][qj][box_curr].first;
                     } else if (qi > qj) { // RSFC
-                        while (box_curr < planResult.RSFC[qj][qi].size() &&
-                               planResult.RSFC[qj][qi][box_curr].second < current_time) {
-                            box_curr++;
+                        box_curr = planResult.RSFC.findCorridor(p, current_time);
+                        normal_vector = -planResult.RSFC.normal[box_curr];
+                        if (normal_vector.norm() == 0) { // redundant segment
+                            continue;
                         }
-                        if (box_curr >= planResult.RSFC[qj][qi].size()) {
-                            box_curr = planResult.RSFC[qj][qi].size() - 1;
-                        }
-
-                        normal_vector = -planResult.RSFC[qj][qi][box_curr].first;
                     } else { // SFC
                         while (box_curr < planResult.SFC[qi].size() &&
                                planResult.SFC[qi][box_curr].second < current_time) {
@@ -8,14 +8,11 @@
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
 
-// CPLEX
-#include <ilcplex/ilocplex.h>
-
 // Others
 #include <mission.hpp>
 #include <param.hpp>
-
-ILOSTLBEGIN
+#include <qp_problem.hpp>
+#include <qp_solver.hpp>
 
 namespace SwarmPlanning {
     class SCPPlanner {
@@ -43,30 +40,20 @@ namespace SwarmPlanning {
         }
 
         bool update(bool log) {
-            IloEnv env;
             Timer timer;
 
             u.resize(outdim * N * K);
-            try {
-                timer.reset();
-                buildConstMtx();
-                timer.stop();
-                ROS_INFO_STREAM("Constraint Matrix runtime: " << timer.elapsedSeconds());
+            timer.reset();
+            buildConstMtx();
+            timer.stop();
+            ROS_INFO_STREAM("Constraint Matrix runtime: " << timer.elapsedSeconds());
 
-                timer.reset();
-                solveQP(env, log);
-                timer.stop();
-                ROS_INFO_STREAM("QP runtime: " << timer.elapsedSeconds());
-            }
-            catch (IloException &e) {
-                ROS_ERROR_STREAM("Concert exception caught: " << e);
-                return false;
-            }
-            catch (...) {
-                ROS_ERROR("Unknown exception caught");
+            timer.reset();
+            if (!solveQP(log)) {
                 return false;
             }
-            env.end();
+            timer.stop();
+            ROS_INFO_STREAM("QP runtime: " << timer.elapsedSeconds());
 
             createMsg();
             return true;
@@ -78,7 +65,7 @@ namespace SwarmPlanning {
 
         double h, T, p_max, v_max, a_max, j_max, epsilon;
         int K, N, outdim;
-        IloNum count_x, count_eq, count_lq;
+        int count_x, count_eq, count_lq;
 
         Eigen::MatrixXd Q, A_eq, b_eq, A_ineq, b_ineq,
                 P, V, A, J, p_start, p_goal,
@@ -92,43 +79,27 @@ namespace SwarmPlanning {
             build_ineq_const();
         }
 
-        void solveQP(const IloEnv &env, bool log) {
+        bool solveQP(bool log) {
             Timer timer;
-            IloNum cost_total, cost_prev;
-
-            IloCplex cplex(env);
-//        cplex.setParam(IloCplex::Param::TimeLimit, 0.04);
+            double cost_total, cost_prev;
+            std::shared_ptr<QPSolver> qp_solver = createQPSolver(param, log, param.package_path + "/log/QPmodel.lp");
 
             cost_total = SP_INFINITY;
             cost_prev = 0;
             int iter = 0;
 
             timer.reset();
-            while (abs(cost_total - cost_prev) > epsilon * cost_total) {
-                IloModel model(env);
-                IloNumVarArray var(env);
-                IloRangeArray con(env);
-
-                populatebyrow(model, var, con);
-
-                cplex.extract(model);
-
-                if (log) {
-                    cplex.exportModel("/home/jungwon/QPmodel.lp");
-                } else {
-                    cplex.setOut(env.getNullStream());
-                }
+            Eigen::VectorXd vals;
+            while (std::abs(cost_total - cost_prev) > epsilon * cost_total) {
+                QPProblem qp;
+                buildQP(&qp);
 
-                // Optimize the problem and obtain solution.
-                if (!cplex.solve()) {
-                    env.error() << "Failed to optimize QP, Check ~/.ros/QPresult.txt" << endl;
-                    throw (-1);
-                }
-
-                IloNumArray vals(env);
+                // Optimize the problem and obtain solution, the previous solution is the initial guess
                 cost_prev = cost_total;
-                cost_total = cplex.getObjValue();
-                cplex.getValues(vals, var);
+                if (!qp_solver->solve(qp, &vals, &cost_total)) {
+                    ROS_ERROR("Failed to optimize QP");
+                    return false;
+                }
 
                 // update input
                 for (int dim = 0; dim < outdim; dim++) {
@@ -154,6 +125,7 @@ namespace SwarmPlanning {
             }
 
             ROS_INFO_STREAM("QP total cost = " << cost_total);
+            return true;
         }
 
         void createMsg() {
@@ -290,69 +262,33 @@ namespace SwarmPlanning {
                     b_ineq_col;
         }
 
-        void populatebyrow(IloModel model, IloNumVarArray x, IloRangeArray c) {
-            IloEnv env = model.getEnv();
-
-            for (int dim = 0; dim < outdim; dim++) {
-                for (int qi = 0; qi < N; qi++) {
-                    for (int k = 0; k < K; k++) {
-                        x.add(IloNumVar(env, -IloInfinity, IloInfinity));
-
-                        std::string name;
-                        if (dim == 0) {
-                            name = "x_" + std::to_string(qi) + "_" + std::to_string(k);
-                        } else if (dim == 1) {
-                            name = "y_" + std::to_string(qi) + "_" + std::to_string(k);
-                        } else {
-                            name = "z_" + std::to_string(qi) + "_" + std::to_string(k);
-                        }
-
-                        int row = dim * N * K + qi * K + k;
-                        x[row].setName(name.c_str());
-                    }
-                }
-            }
-            count_x = x.getSize();
+        // x[dim * N * K + qi * K + k] is the input of the qi-th agent at the k-th step along the dim-th axis
+        void buildQP(QPProblem *qp) {
+            int cols = outdim * N * K;
+            count_x = cols;
 
             // Cost function
-            IloNumExpr cost(env);
-            for (int i = 0; i < Q.rows(); i++) {
-                for (int j = 0; j < Q.cols(); j++) {
-                    if (Q(i, j) != 0) {
-                        cost += Q(i, j) * x[i] * x[j];
-                    }
-                }
-            }
-            model.add(IloMinimize(env, cost));
-
-
-            // Equality Constraints
-            for (int i = 0; i < A_eq.rows(); i++) {
-                IloNumExpr expr(env);
-                for (int j = 0; j < A_eq.cols(); j++) {
-                    if (A_eq(i, j) != 0) {
-                        expr += A_eq(i, j) * x[j];
-                    }
-                }
-                c.add(expr == b_eq(i));
-                expr.end();
-            }
-            count_eq = c.getSize();
-
-            // Inequality Constraints
-            for (int i = 0; i < A_ineq.rows(); i++) {
-                IloNumExpr expr(env);
-                for (int j = 0; j < A_ineq.cols(); j++) {
-                    if (A_ineq(i, j) != 0) {
-                        expr += A_ineq(i, j) * x[j];
-                    }
-                }
-                c.add(expr <= b_ineq(i));
-                expr.end();
-            }
-            count_lq = c.getSize() - count_eq;
-
-            model.add(c);
+            qp->Q = Q.sparseView();
+            qp->Q.makeCompressed();
+
+            // Equality Constraints, followed by Inequality Constraints
+            int rows = A_eq.rows() + A_ineq.rows();
+            Eigen::MatrixXd A_all(rows, cols);
+            A_all << A_eq,
+                    A_ineq;
+            qp->A = A_all.sparseView();
+            qp->A.makeCompressed();
+            qp->row_lower.resize(rows);
+            qp->row_upper.resize(rows);
+            qp->row_lower << b_eq,
+                    Eigen::VectorXd::Constant(A_ineq.rows(), -QP_INFINITY);
+            qp->row_upper << b_eq,
+                    b_ineq;
+            qp->col_lower = Eigen::VectorXd::Constant(cols, -QP_INFINITY);
+            qp->col_upper = Eigen::VectorXd::Constant(cols, QP_INFINITY);
+            qp->num_eq = A_eq.rows();
+            count_eq = A_eq.rows();
+            count_lq = A_ineq.rows();
         }
 
         void position_picker(int qi, int k, Eigen::MatrixXd &P_pick) {
@@ -9,19 +9,71 @@
 
 #define SP_IPT_ECBS          0
 
+#define SP_BATCH_INDEX       0
+#define SP_BATCH_GREEDY      1
+#define SP_BATCH_SPECTRAL    2
+
+#include <algorithm>
 #include <octomap/OcTree.h>
 #include <std_msgs/Float64MultiArray.h>
 #include <std_msgs/MultiArrayDimension.h>
 
 typedef std::vector<std::vector<octomap::point3d>> initTraj_t;
 typedef std::vector<std::vector<std::pair<std::vector<double>, double>>> SFC_t;
-typedef std::vector<std::vector<std::vector<std::pair<octomap::point3d, double> >>> RSFC_t;
+typedef std::vector<std::pair<octomap::point3d, double>> polytope_t; // half-spaces (a, b) of a convex polytope a*x <= b
+typedef std::vector<std::vector<std::pair<polytope_t, double>>> SFC_poly_t;
 
 namespace SwarmPlanning{
+    // Relative safe flight corridors of the agent pairs that can collide, stored contiguously (CSR-like).
+    // Corridors of pair p = pairs[p] = (qi, qj), qi < qj, are (normal[ri], time[ri]) for ri in [offset[p], offset[p+1])
+    struct RSFC_t{
+        std::vector<std::pair<int, int>> pairs; // pair id -> (qi, qj), sorted
+        std::vector<int> offset; // pair id -> index of the first corridor of the pair
+        std::vector<octomap::point3d> normal; // normal vector of the relative corridor, zero if it is redundant
+        std::vector<double> time; // end time of the relative corridor
+
+        RSFC_t() : offset(1, 0) {}
+
+        int size() const { return pairs.size(); }
+
+        void clear() {
+            pairs.clear();
+            offset.assign(1, 0);
+            normal.clear();
+            time.clear();
+        }
+
+        // Pairs must be added in ascending order of (qi, qj)
+        void addPair(int qi, int qj, const std::vector<std::pair<octomap::point3d, double>>& corridors) {
+            pairs.emplace_back(qi, qj);
+            for (const auto& corridor : corridors) {
+                normal.emplace_back(corridor.first);
+                time.emplace_back(corridor.second);
+            }
+            offset.emplace_back(normal.size());
+        }
+
+        // Pair id of (qi, qj), -1 if they have no RSFC
+        int findPair(int qi, int qj) const {
+            auto it = std::lower_bound(pairs.begin(), pairs.end(), std::make_pair(qi, qj));
+            if (it == pairs.end() || *it != std::make_pair(qi, qj)) {
+                return -1;
+            }
+            return it - pairs.begin();
+        }
+
+        // Index of the corridor of pair p which is active at time t
+        int findCorridor(int p, double t) const {
+            int ri = std::lower_bound(time.begin() + offset[p], time.begin() + offset[p + 1], t) - time.begin();
+            return std::min(ri, offset[p + 1] - 1);
+        }
+    };
+
     struct PlanResult{
         initTraj_t initTraj; // discrete initial trajectory: pi_0,...,pi_M
         std::vector<double> T; // segment time: T_0,...,T_M
-        SFC_t SFC; // safe flight corridors to avoid obstacles
+        SFC_t SFC; // safe flight corridors to avoid obstacles, bounding boxes of SFC_poly if polytopes are used
+        SFC_poly_t SFC_poly; // convex polytope safe flight corridors, empty if boxes are used
         RSFC_t RSFC; // relative safe flight corridors to avoid inter-collision
         std_msgs::Float64MultiArray msgs_traj_info; // [N, n, T_0, ... , T_M]
         std::vector<std_msgs::Float64MultiArray> msgs_traj_coef; //
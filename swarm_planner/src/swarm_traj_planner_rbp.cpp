@@ -1,11 +1,12 @@
 // ROS
 #include <ros/ros.h>
+#include <deque>
 
 // Octomap
 #include <octomap_msgs/Octomap.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/OcTree.h>
-#include <dynamicEDT3D/dynamicEDTOctomap.h>
+#include <distance_field.hpp>
 
 // Parameters
 #include <param.hpp>
@@ -22,16 +23,25 @@ using namespace SwarmPlanning;
 
 bool has_octomap = false;
 bool has_path = false;
+bool continuous = false; // accept octomap updates after the first one
+bool map_updated = false;
 std::shared_ptr<octomap::OcTree> octree_obj;
+std::shared_ptr<octomap::OcTree> new_octree_obj; // the latest octomap update in continuous mode
 
 void octomapCallback(const octomap_msgs::Octomap& octomap_msg)
 {
-    if(has_octomap)
+    if(has_octomap && !continuous)
         return;
 
-    octree_obj.reset(dynamic_cast<octomap::OcTree*>(octomap_msgs::fullMsgToMap(octomap_msg)));
-
-    has_octomap = true;
+    std::shared_ptr<octomap::OcTree> octree(dynamic_cast<octomap::OcTree*>(octomap_msgs::fullMsgToMap(octomap_msg)));
+    if(!has_octomap) {
+        octree_obj = octree;
+        has_octomap = true;
+    }
+    else {
+        new_octree_obj = octree;
+        map_updated = true;
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -52,40 +62,37 @@ int main(int argc, char* argv[]) {
         return -1;
     }
     param.setColor(mission.qn);
+    continuous = param.map_continuous;
 
     // Submodules
     SwarmPlanning::PlanResult planResult;
-    std::shared_ptr<DynamicEDTOctomap> distmap_obj;
+    std::shared_ptr<DistanceField> distmap_obj;
     std::shared_ptr<InitTrajPlanner> initTrajPlanner_obj;
     std::shared_ptr<Corridor> corridor_obj;
     std::shared_ptr<RBPPlanner> RBPPlanner_obj;
     std::shared_ptr<RBPPublisher> RBPPublisher_obj;
+    std::deque<std::pair<double, std::shared_ptr<RBPPublisher>>> next_plans; // replans and their take-over times
 
     // Main Loop
     ros::Rate rate(20);
     Timer timer_total;
     Timer timer_step;
     double start_time, current_time;
+    double plan_runtime; // the last planning runtime, to predict when a replan takes over
     while (ros::ok()) {
         if (has_octomap && !has_path) {
             timer_total.reset();
 
             // Build 3D Euclidean Distance Field
             timer_step.reset();
-            {
-                float maxDist = 1;
-                octomap::point3d min_point3d(param.world_x_min, param.world_y_min, param.world_z_min);
-                octomap::point3d max_point3d(param.world_x_max, param.world_y_max, param.world_z_max);
-                distmap_obj.reset(new DynamicEDTOctomap(maxDist, octree_obj.get(), min_point3d, max_point3d, false));
-                distmap_obj.get()->update();
-            }
+            distmap_obj = buildDistanceField(octree_obj.get(), param);
             timer_step.stop();
             ROS_INFO_STREAM("distmap runtime: " << timer_step.elapsedSeconds());
 
             // Step 1: Plan Initial Trajectory
             timer_step.reset();
             {
-                initTrajPlanner_obj.reset(new ECBSPlanner(distmap_obj, mission, param));
+                initTrajPlanner_obj.reset(new ECBSPlanner(distmap_obj, mission, param, octree_obj));
                 if (!initTrajPlanner_obj.get()->update(param.log, &planResult)) {
                     return -1;
                 }
@@ -96,7 +103,7 @@ int main(int argc, char* argv[]) {
             // Step 2: Generate SFC, RSFC
             timer_step.reset();
             {
-                corridor_obj.reset(new Corridor(distmap_obj, mission, param));
+                corridor_obj.reset(new Corridor(distmap_obj, mission, param, octree_obj));
                 if (!corridor_obj.get()->update(param.log, &planResult)) {
                     return -1;
                 }
@@ -117,6 +124,7 @@ int main(int argc, char* argv[]) {
 
             timer_total.stop();
             ROS_INFO_STREAM("Overall runtime: " << timer_total.elapsedSeconds());
+            plan_runtime = timer_total.elapsedSeconds();
 
             // Plot Planning Result
             RBPPublisher_obj.reset(new RBPPublisher(nh, planResult, mission, param));
@@ -125,7 +133,90 @@ int main(int argc, char* argv[]) {
             start_time = ros::Time::now().toSec();
             has_path = true;
         }
+        if (has_path && map_updated) {
+            map_updated = false;
+            timer_total.reset();
+
+            // Update 3D Euclidean Distance Field only where the map is changed
+            timer_step.reset();
+            std::vector<double> changed_region;
+            std::dynamic_pointer_cast<EDTDistanceField>(distmap_obj)->updateMap(*new_octree_obj, &changed_region);
+            new_octree_obj.reset();
+            timer_step.stop();
+            ROS_INFO_STREAM("distmap update runtime: " << timer_step.elapsedSeconds());
+
+            if (changed_region.empty()) {
+                ROS_INFO("Map: no change");
+            }
+            else {
+                SwarmPlanning::PlanResult planResult_new;
+
+                // The agents keep flying the last plan while replanning, so the new plan starts from their state
+                // at the predicted take-over time, and it is published from then
+                double replan_time = ros::Time::now().toSec() + param.map_replan_margin * plan_runtime;
+                if (next_plans.empty()) {
+                    mission.startState = RBPPublisher_obj.get()->getState(replan_time - start_time);
+                }
+                else {
+                    replan_time = std::max(replan_time, next_plans.back().first);
+                    mission.startState = next_plans.back().second->getState(replan_time - next_plans.back().first);
+                }
+
+                // Step 1: Replan Initial Trajectory with the obstacles updated in the changed region
+                timer_step.reset();
+                {
+                    if (!initTrajPlanner_obj.get()->updateObstacles(changed_region) ||
+                        !initTrajPlanner_obj.get()->setStartState(mission.startState) ||
+                        !initTrajPlanner_obj.get()->update(param.log, &planResult_new)) {
+                        return -1;
+                    }
+                }
+                timer_step.stop();
+                ROS_INFO_STREAM("Initial Trajectory Planner runtime: " << timer_step.elapsedSeconds());
+
+                // Step 2: Regenerate SFC, RSFC of the agents whose grid path is changed or whose SFC meets the
+                // changed region, the others are reused from the last plan
+                timer_step.reset();
+                {
+                    if (!corridor_obj.get()->update(param.log, &planResult_new, changed_region)) {
+                        return -1;
+                    }
+                }
+                timer_step.stop();
+                ROS_INFO_STREAM("BoxGenerator runtime: " << timer_step.elapsedSeconds());
+
+                // Step 3: Formulate QP problem and solving it to generate trajectory for quadrotor swarm
+                timer_step.reset();
+                {
+                    RBPPlanner_obj.reset(new RBPPlanner(mission, param));
+                    if (!RBPPlanner_obj.get()->update(param.log, &planResult_new)) {
+                        return -1;
+                    }
+                }
+                timer_step.stop();
+                ROS_INFO_STREAM("SwarmPlanner runtime: " << timer_step.elapsedSeconds());
+
+                timer_total.stop();
+                ROS_INFO_STREAM("Overall replanning runtime: " << timer_total.elapsedSeconds());
+                plan_runtime = timer_total.elapsedSeconds();
+                if (ros::Time::now().toSec() > replan_time) {
+                    ROS_WARN_STREAM("Replanning took " << ros::Time::now().toSec() - replan_time
+                                                       << "s longer than predicted, increase map/replan_margin");
+                }
+
+                planResult = planResult_new;
+                next_plans.emplace_back(replan_time, std::make_shared<RBPPublisher>(nh, planResult, mission, param));
+                next_plans.back().second->plot(param.log);
+            }
+        }
         if(has_path) {
+            // Switch to the replan when its take-over time comes
+            while (!next_plans.empty() && ros::Time::now().toSec() >= next_plans.front().first) {
+                start_time = next_plans.front().first;
+                RBPPublisher_obj = next_plans.front().second;
+                next_plans.pop_front();
+            }
+
             // Publish Swarm Trajectory
             current_time = ros::Time::now().toSec() - start_time;
             RBPPublisher_obj.get()->update(current_time);
@@ -5,7 +5,7 @@
 #include <octomap_msgs/Octomap.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/OcTree.h>
-#include <dynamicEDT3D/dynamicEDTOctomap.h>
+#include <distance_field.hpp>
 
 // Parameters
 #include <param.hpp>
@@ -55,7 +55,7 @@ int main(int argc, char* argv[]) {
 
     // Submodules
     SwarmPlanning::PlanResult planResult;
-    std::shared_ptr<DynamicEDTOctomap> distmap_obj;
+    std::shared_ptr<DistanceField> distmap_obj;
     std::shared_ptr<InitTrajPlanner> initTrajPlanner_obj;
     std::shared_ptr<Corridor> corridor_obj;
     std::shared_ptr<RBPPlanner> RBPPlanner_obj;
@@ -72,20 +72,14 @@ int main(int argc, char* argv[]) {
 
             // Build 3D Euclidean Distance Field
             timer_step.reset();
-            {
-                float maxDist = 1;
-                octomap::point3d min_point3d(param.world_x_min, param.world_y_min, param.world_z_min);
-                octomap::point3d max_point3d(param.world_x_max, param.world_y_max, param.world_z_max);
-                distmap_obj.reset(new DynamicEDTOctomap(maxDist, octree_obj.get(), min_point3d, max_point3d, false));
-                distmap_obj.get()->update();
-            }
+            distmap_obj = buildDistanceField(octree_obj.get(), param);
             timer_step.stop();
             ROS_INFO_STREAM("distmap runtime: " << timer_step.elapsedSeconds());
 
             // Step 1: Plan Initial Trajectory
             timer_step.reset();
             {
-                initTrajPlanner_obj.reset(new ECBSPlanner(distmap_obj, mission, param));
+                initTrajPlanner_obj.reset(new ECBSPlanner(distmap_obj, mission, param, octree_obj));
                 if (!initTrajPlanner_obj.get()->update(param.log, &planResult)) {
                     return -1;
                 }
@@ -96,7 +90,7 @@ int main(int argc, char* argv[]) {
             // Step 2: Generate SFC, RSFC
             timer_step.reset();
             {
-                corridor_obj.reset(new Corridor(distmap_obj, mission, param));
+                corridor_obj.reset(new Corridor(distmap_obj, mission, param, octree_obj));
                 if (!corridor_obj.get()->update_flat_box(param.log, &planResult)) {
                     return -1;
                 }
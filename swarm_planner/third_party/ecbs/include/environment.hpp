@@ -7,6 +7,9 @@
 #ifndef SWARM_PLANNER_ENVIRONMENT_H
 #define SWARM_PLANNER_ENVIRONMENT_H
 
+#include <cstdint>
+#include <vector>
+
 #include <ecbs.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/program_options.hpp>
@@ -348,7 +351,8 @@ namespace libMultiRobotPlanning {
     class Environment {
     public:
         Environment(size_t dimx, size_t dimy, size_t dimz,
-                    std::unordered_set<Location> obstacles,
+                    std::vector<std::vector<uint8_t>> obstacles,
+                    std::vector<int> agentLayer,
                     std::vector<Location> goals,
                     std::vector<double> quad_size,
                     double grid_size)
@@ -356,6 +360,7 @@ namespace libMultiRobotPlanning {
                   m_dimy(dimy),
                   m_dimz(dimz),
                   m_obstacles(std::move(obstacles)),
+                  m_agentLayer(std::move(agentLayer)),
                   m_goals(std::move(goals)),
                   m_agentIdx(0),
                   m_constraints(nullptr),
@@ -636,7 +641,7 @@ namespace libMultiRobotPlanning {
             assert(m_constraints);
             const auto &con = m_constraints->vertexConstraints;
             return s.x >= 0 && s.x < m_dimx && s.y >= 0 && s.y < m_dimy && s.z >= 0 && s.z < m_dimz &&
-                   m_obstacles.find(Location(s.x, s.y, s.z)) == m_obstacles.end() &&
+                   m_obstacles[m_agentLayer[m_agentIdx]][(s.z * m_dimy + s.y) * m_dimx + s.x] == 0 &&
                    con.find(VertexConstraint(s.time, s.x, s.y, s.z)) == con.end();
         }
 
@@ -684,7 +689,8 @@ namespace libMultiRobotPlanning {
         int m_dimx;
         int m_dimy;
         int m_dimz;
-        std::unordered_set<Location> m_obstacles;
+        std::vector<std::vector<uint8_t>> m_obstacles; // dense occupancy grid per layer, index (z * dimy + y) * dimx + x
+        std::vector<int> m_agentLayer; // obstacle layer of each agent
         std::vector<Location> m_goals;
         size_t m_agentIdx;
         const Constraints *m_constraints;